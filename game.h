@@ -15,16 +15,17 @@ public:
 	void DrawGrid();
 	void Simulation();
 	void Tick( float deltaTime );
-	void Shutdown() { /* implement if you want to do something on exit */ }
+	void Shutdown();
 	// input handling
 	void MouseUp( int ) { /* implement if you want to detect mouse button presses */ }
 	void MouseDown( int ) { /* implement if you want to detect mouse button presses */ }
 	void MouseMove( int x, int y ) { mousePos.x = x, mousePos.y = y; }
 	void MouseWheel( float ) { /* implement if you want to handle the mouse wheel */ }
 	void KeyUp( int ) { /* implement if you want to handle keys */ }
-	void KeyDown( int ) { /* implement if you want to handle keys */ }
+	void KeyDown( int key );
 	// data members
 	int2 mousePos;
+	Binner* binner = 0; // draws the grid on many cores
 };
 
 } // namespace Tmpl8
\ No newline at end of file
@@ -0,0 +1,336 @@
+// Template, IGAD version 3
+// Get the latest version from: https://github.com/jbikker/tmpl8
+// IGAD/NHTV/UU - Jacco Bikker - 2006-2023
+
+#include "precomp.h"
+
+// Microbenchmarks for the template's rendering primitives. Each benchmark
+// compares an optimized path against its reference on the same input,
+// verifies that both produce identical pixels, and reports the best time
+// over a number of runs. Results are printed to the console.
+
+#define BENCH_RUNS 20
+
+// best-of-N timing of a callable, in milliseconds
+template <class F> static float BestOf( F f )
+{
+	float best = 1e30f;
+	for (int i = 0; i < BENCH_RUNS; i++)
+	{
+		Timer t;
+		f();
+		best = min( best, t.elapsed() * 1000 );
+	}
+	return best;
+}
+
+static int CountDifferences( const Surface& a, const Surface& b )
+{
+	int diff = 0;
+	for (int y = 0; y < a.height; y++) for (int x = 0; x < a.width; x++)
+		if (a.pixels[x + y * a.pitch] != b.pixels[x + y * b.pitch]) diff++;
+	return diff;
+}
+
+// a jittered 256x256 grid, similar to the cloth: ~130k short segments, some
+// of them partially or fully off-screen.
+static void BenchmarkLines()
+{
+	const int N = 256, count = (N - 1) * N * 2;
+	float2* a = new float2[count], * b = new float2[count];
+	float2* p = new float2[N * N];
+	uint seed = 0x1234;
+	for (int y = 0; y < N; y++) for (int x = 0; x < N; x++)
+		p[x + y * N] = float2( -40 + x * (SCRWIDTH + 80) / (float)N + RandomFloat( seed ) * 2, 10 + y * (SCRHEIGHT - 20) / (float)N + RandomFloat( seed ) * 2 );
+	int n = 0;
+	for (int y = 0; y < N - 1; y++) for (int x = 0; x < N - 1; x++)
+	{
+		a[n] = p[x + y * N], b[n++] = p[x + 1 + y * N];
+		a[n] = p[x + y * N], b[n++] = p[x + (y + 1) * N];
+	}
+	Surface s1( SCRWIDTH, SCRHEIGHT ), s2( SCRWIDTH, SCRHEIGHT );
+	s1.Clear( 0 ), s2.Clear( 0 );
+	const float t1 = BestOf( [&]() { for (int i = 0; i < n; i++) s1.Line( a[i].x, a[i].y, b[i].x, b[i].y, 0xffffff ); } );
+	const float t2 = BestOf( [&]() { s2.Lines( a, b, n, 0xffffff ); } );
+	printf( "lines (%i segments): per-call %.3f ms, batched %.3f ms (%.2fx), %i pixels differ\n",
+		n, t1, t2, t1 / t2, CountDifferences( s1, s2 ) );
+	delete[] a;
+	delete[] b;
+	delete[] p;
+}
+
+// the same kind of grid, drawn edge by edge and as a mesh with shared
+// vertices. Vertices are embedded in a larger struct, like the cloth points.
+static void BenchmarkGrid()
+{
+	struct Vertex { float2 pos, other[2]; };
+	const int N = 256;
+	Vertex* p = new Vertex[N * N];
+	uint seed = 0x1234;
+	for (int y = 0; y < N; y++) for (int x = 0; x < N; x++)
+		p[x + y * N].pos = float2( -40 + x * (SCRWIDTH + 80) / (float)N + RandomFloat( seed ) * 2, 10 + y * (SCRHEIGHT - 20) / (float)N + RandomFloat( seed ) * 2 );
+	Surface s1( SCRWIDTH, SCRHEIGHT ), s2( SCRWIDTH, SCRHEIGHT );
+	s1.Clear( 0 ), s2.Clear( 0 );
+	const float t1 = BestOf( [&]() {
+		for (int y = 0; y < N; y++) for (int x = 0; x < N; x++)
+		{
+			const float2 a = p[x + y * N].pos;
+			if (x < N - 1) s1.Line( a.x, a.y, p[x + 1 + y * N].pos.x, p[x + 1 + y * N].pos.y, 0xffffff );
+			if (y < N - 1) s1.Line( a.x, a.y, p[x + (y + 1) * N].pos.x, p[x + (y + 1) * N].pos.y, 0xffffff );
+		}
+	} );
+	const float t2 = BestOf( [&]() { s2.Grid( &p[0].pos, sizeof( Vertex ), N * sizeof( Vertex ), N, N, 0xffffff ); } );
+	printf( "grid (%ix%i vertices): per-edge %.3f ms, mesh %.3f ms (%.2fx), %i pixels differ\n",
+		N, N, t1, t2, t1 / t2, CountDifferences( s1, s2 ) );
+	Surface s3( SCRWIDTH, SCRHEIGHT );
+	s3.Clear( 0 );
+	Binner binner( &s3 );
+	const float t3 = BestOf( [&]() {
+		binner.Grid( &p[0].pos, sizeof( Vertex ), N * sizeof( Vertex ), N, N, 0xffffff );
+		binner.Render();
+	} );
+	printf( "grid, binned on %i threads: %.3f ms (%.2fx per-edge), %i pixels differ\n",
+		JobManager::GetJobManager()->GetNumThreads(), t3, t1 / t3, CountDifferences( s1, s3 ) );
+	delete[] p;
+}
+
+// full-screen clears and a set of clipped bars, against scalar loops
+static void BenchmarkFill()
+{
+	Surface s1( SCRWIDTH, SCRHEIGHT ), s2( SCRWIDTH, SCRHEIGHT ), s3( SCRWIDTH, SCRHEIGHT );
+	const float t1 = BestOf( [&]() { for (int i = 0; i < SCRWIDTH * SCRHEIGHT; i++) s1.pixels[i] = 0x203040; } );
+	const float t2 = BestOf( [&]() { s2.Clear( 0x203040 ); } );
+	const float t3 = BestOf( [&]() { s3.ClearStreaming( 0x203040 ); } );
+	printf( "clear (%ix%i): scalar %.3f ms, simd %.3f ms, streaming %.3f ms, %i pixels differ\n",
+		SCRWIDTH, SCRHEIGHT, t1, t2, t3, CountDifferences( s1, s2 ) + CountDifferences( s1, s3 ) );
+	// streaming stores leave the buffer out of the cache, so drawing right
+	// after the clear pays for that.
+	float2 a[1000], b[1000];
+	uint seed = 0x1234;
+	for (int i = 0; i < 1000; i++)
+		a[i] = float2( RandomFloat( seed ) * SCRWIDTH, RandomFloat( seed ) * SCRHEIGHT ), b[i] = a[i] + float2( 30, 20 );
+	const float t4 = BestOf( [&]() { s2.Clear( 0 ); s2.Lines( a, b, 1000, 0xffffff ); } );
+	const float t5 = BestOf( [&]() { s3.ClearStreaming( 0 ); s3.Lines( a, b, 1000, 0xffffff ); } );
+	printf( "clear + 1000 lines: simd %.3f ms, streaming %.3f ms\n", t4, t5 );
+	int bar[256][4];
+	s1.Clear( 0 ), s2.Clear( 0 );
+	for (int i = 0; i < 256; i++)
+	{
+		const int x = (int)(RandomFloat( seed ) * (SCRWIDTH + 200)) - 100, y = (int)(RandomFloat( seed ) * (SCRHEIGHT + 200)) - 100;
+		bar[i][0] = x, bar[i][1] = y, bar[i][2] = x + RandomUInt( seed ) % 200, bar[i][3] = y + RandomUInt( seed ) % 200;
+	}
+	const float t6 = BestOf( [&]() {
+		for (int i = 0; i < 256; i++)
+		{
+			const int x1 = max( 0, bar[i][0] ), y1 = max( 0, bar[i][1] );
+			const int x2 = min( SCRWIDTH - 1, bar[i][2] ), y2 = min( SCRHEIGHT - 1, bar[i][3] );
+			for (int y = y1; y <= y2; y++) for (int x = x1; x <= x2; x++) s1.pixels[x + y * s1.pitch] = i * 0x010101;
+		}
+	} );
+	const float t7 = BestOf( [&]() { for (int i = 0; i < 256; i++) s2.Bar( bar[i][0], bar[i][1], bar[i][2], bar[i][3], i * 0x010101 ); } );
+	printf( "bars (256 clipped): scalar %.3f ms, simd %.3f ms (%.2fx), %i pixels differ\n",
+		t6, t7, t6 / t7, CountDifferences( s1, s2 ) );
+}
+
+// full-screen effect passes: scalar pixel operations against the spans
+static void BenchmarkBlend()
+{
+	const int N = SCRWIDTH * SCRHEIGHT;
+	Surface src( SCRWIDTH, SCRHEIGHT ), s1( SCRWIDTH, SCRHEIGHT ), s2( SCRWIDTH, SCRHEIGHT );
+	uint seed = 0x1234;
+	for (int i = 0; i < N; i++) src.pixels[i] = RandomUInt( seed ), s1.pixels[i] = s2.pixels[i] = RandomUInt( seed );
+	const float t1 = BestOf( [&]() { for (int i = 0; i < N; i++) s1.pixels[i] = AddBlend( s1.pixels[i], src.pixels[i] ); } );
+	const float t2 = BestOf( [&]() { AddBlend( s2.pixels, src.pixels, N ); } );
+	printf( "add blend: scalar %.3f ms, span %.3f ms (%.2fx), %i pixels differ\n", t1, t2, t1 / t2, CountDifferences( s1, s2 ) );
+	const float t3 = BestOf( [&]() { for (int i = 0; i < N; i++) s1.pixels[i] = SubBlend( s1.pixels[i], src.pixels[i] ); } );
+	const float t4 = BestOf( [&]() { SubBlend( s2.pixels, src.pixels, N ); } );
+	printf( "sub blend: scalar %.3f ms, span %.3f ms (%.2fx), %i pixels differ\n", t3, t4, t3 / t4, CountDifferences( s1, s2 ) );
+	for (int i = 0; i < N; i++) s1.pixels[i] = s2.pixels[i] = src.pixels[i];
+	const float t5 = BestOf( [&]() { for (int i = 0; i < N; i++) s1.pixels[i] = ScaleColor( s1.pixels[i], 250 ); } );
+	const float t6 = BestOf( [&]() { s2.Fade( 250 ); } );
+	printf( "fade: scalar %.3f ms, span %.3f ms (%.2fx), %i pixels differ\n", t5, t6, t5 / t6, CountDifferences( s1, s2 ) );
+}
+
+// 2000 sprites, partially off-screen: the per-pixel opacity test of the
+// original Sprite::Draw against the opaque-run blitter
+static void BenchmarkSprites()
+{
+	const int W = 64, H = 64, F = 2;
+	Surface* image = new Surface( W * F, H );
+	for (int y = 0; y < H; y++) for (int x = 0; x < W * F; x++)
+	{
+		// a ring with a gap: about 40% opaque, several runs per row
+		const float dx = (x % W) - 31.5f, dy = y - 31.5f, r = sqrtf( dx * dx + dy * dy );
+		image->pixels[x + y * image->pitch] = (r > 12 && r < 30 && fabsf( dx ) > 4) ? 0xff000000 + x * 0x0201 + y * 0x030000 : 0;
+	}
+	Sprite sprite( image, F );
+	int pos[2000][2];
+	uint seed = 0x1234;
+	for (int i = 0; i < 2000; i++) pos[i][0] = (int)(RandomFloat( seed ) * (SCRWIDTH + W)) - W, pos[i][1] = (int)(RandomFloat( seed ) * (SCRHEIGHT + H)) - H;
+	Surface s1( SCRWIDTH, SCRHEIGHT ), s2( SCRWIDTH, SCRHEIGHT );
+	s1.Clear( 0 ), s2.Clear( 0 );
+	const float t1 = BestOf( [&]() {
+		for (int i = 0; i < 2000; i++)
+		{
+			const uint frame = i & 1;
+			const int x1 = max( 0, pos[i][0] ), x2 = min( SCRWIDTH, pos[i][0] + W );
+			const int y1 = max( 0, pos[i][1] ), y2 = min( SCRHEIGHT, pos[i][1] + H );
+			for (int y = y1; y < y2; y++) for (int x = x1; x < x2; x++)
+			{
+				const uint c = image->pixels[frame * W + x - pos[i][0] + (y - pos[i][1]) * image->pitch];
+				if (c & 0xffffff) s1.pixels[x + y * s1.pitch] = c;
+			}
+		}
+	} );
+	const float t2 = BestOf( [&]() { for (int i = 0; i < 2000; i++) sprite.SetFrame( i & 1 ), sprite.Draw( &s2, pos[i][0], pos[i][1] ); } );
+	printf( "sprites (2000, %ix%i): per-pixel %.3f ms, runs %.3f ms (%.2fx), %i pixels differ\n",
+		W, H, t1, t2, t1 / t2, CountDifferences( s1, s2 ) );
+}
+
+// a 64x64 sprite scaled to 512x384, on-screen: the original column-major
+// float scaler against the table-driven one, and the bilinear path.
+static void BenchmarkScaled()
+{
+	const int W = 64, H = 64, DW = 512, DH = 384;
+	Surface* image = new Surface( W, H );
+	uint seed = 0x1234;
+	for (int i = 0; i < W * H; i++) image->pixels[i] = (RandomUInt( seed ) & 3) ? RandomUInt( seed ) : 0;
+	Sprite sprite( image, 1 );
+	Surface s1( SCRWIDTH, SCRHEIGHT ), s2( SCRWIDTH, SCRHEIGHT );
+	s1.Clear( 0 ), s2.Clear( 0 );
+	const float t1 = BestOf( [&]() {
+		for (int x = 0; x < DW; x++) for (int y = 0; y < DH; y++)
+		{
+			const int u = (int)((float)x * ((float)W / (float)DW)), v = (int)((float)y * ((float)H / (float)DH));
+			const uint c = image->pixels[u + v * image->pitch];
+			if (c & 0xffffff) s1.pixels[100 + x + (100 + y) * s1.pitch] = c;
+		}
+	} );
+	const float t2 = BestOf( [&]() { sprite.DrawScaled( 100, 100, DW, DH, &s2 ); } );
+	const float t3 = BestOf( [&]() { sprite.DrawScaled( 100, 100, DW, DH, &s2, true ); } );
+	printf( "scaled sprite (%ix%i to %ix%i): float %.3f ms, table %.3f ms (%.2fx), bilinear %.3f ms\n",
+		W, H, DW, DH, t1, t2, t1 / t2, t3 );
+}
+
+// fork-join latency with trivial jobs: back to back, where the workers
+// spin between batches, and 2 ms apart, where they go to sleep
+static void BenchmarkDispatch()
+{
+	JobManager* jm = JobManager::GetJobManager();
+	atomic<int> sink{ 0 };
+	auto ForkJoin = [&]() { ParallelFor( 0, jm->GetNumThreads(), 1, [&]( int ) { sink++; } ); };
+	char t[256];
+	const int N = 2000, M = 100;
+	jm->Report( t ); // restarts the statistics
+	Timer timer;
+	for (int i = 0; i < N; i++) ForkJoin();
+	const float t1 = timer.elapsed() * 1e6f / N;
+	jm->Report( t );
+	printf( "fork-join, back to back: %.2f us; %s", t1, t );
+	float t2 = 0;
+	for (int i = 0; i < M; i++)
+	{
+		this_thread::sleep_for( chrono::milliseconds( 2 ) );
+		timer.reset();
+		ForkJoin();
+		t2 += timer.elapsed();
+	}
+	jm->Report( t );
+	printf( "fork-join, 2 ms apart: %.2f us; %s", t2 * 1e6f / M, t );
+}
+
+// Self-checks
+// Deterministic tests of optimized code that must do exactly what its
+// reference does. They run before the benchmarks; a mismatch is fatal.
+
+// the span ScaleColor against the scalar one, for every scale up to 512 and
+// every value of every channel, alpha included; 1021 pixels, so the span
+// ends in a partial block
+static void CheckScaleColor()
+{
+	const int N = 1021;
+	uint src[N], dst[N], seed = 0x1234;
+	for (int i = 0; i < N; i++) src[i] = i < 256 ? i * 0x01010101 : RandomUInt( seed );
+	for (uint scale = 0; scale <= 512; scale++)
+	{
+		ScaleColor( dst, src, N, scale );
+		for (int i = 0; i < N; i++) if (dst[i] != ScaleColor( src[i], scale ))
+			FatalError( "ScaleColor( %08x, %i ): span %08x, scalar %08x", src[i], scale, dst[i], ScaleColor( src[i], scale ) );
+	}
+}
+
+// the job system: every index of a ParallelFor once, ParallelReduce, jobs
+// that add jobs, jobs for every node, and the order of a TaskGraph
+static void CheckJobSystem()
+{
+	JobManager* jm = JobManager::GetJobManager();
+	const int N = 100000;
+	vector<atomic<int>> hits( N );
+	for (int grain : { 0, 1, 7, N })
+	{
+		for (atomic<int>& h : hits) h = 0;
+		ParallelFor( 0, N, grain, [&]( const int i ) { hits[i]++; } );
+		for (int i = 0; i < N; i++) if (hits[i] != 1) FatalError( "ParallelFor, grain %i: index %i ran %i times.", grain, i, (int)hits[i] );
+	}
+	const int64_t sum = ParallelReduce( 0, N, 13, (int64_t)0, []( const int i ) { return (int64_t)i; }, []( const int64_t a, const int64_t b ) { return a + b; } );
+	if (sum != (int64_t)N * (N - 1) / 2) FatalError( "ParallelReduce: %lld instead of %lld.", (long long)sum, (long long)N * (N - 1) / 2 );
+	// a tree of 1 + 4 + 16 + ... + 4^6 jobs, where every job adds its children
+	struct TreeJob : public Job
+	{
+		void Main()
+		{
+			(*ran)++;
+			if (depth > 0) for (int i = 0; i < 4; i++) child[i].depth = depth - 1, child[i].ran = ran, JobManager::GetJobManager()->AddJob2( &child[i] );
+		}
+		int depth = 0;
+		atomic<int>* ran = 0;
+		TreeJob* child = 0;
+	};
+	vector<TreeJob> tree( 5461 );
+	for (int i = 0; i < 1365; i++) tree[i].child = &tree[4 * i + 1];
+	atomic<int> ran{ 0 };
+	tree[0].depth = 6, tree[0].ran = &ran;
+	jm->AddJob2( &tree[0] );
+	jm->RunJobs();
+	if (ran != 5461) FatalError( "Jobs that add jobs: %i of 5461 ran.", (int)ran );
+	struct CountJob : public Job { void Main() { ran++; } atomic<int> ran{ 0 }; };
+	vector<CountJob> bound( 4 * jm->GetNumNodes() );
+	for (int i = 0; i < (int)bound.size(); i++) jm->AddJob2( &bound[i], i );
+	jm->RunJobs();
+	for (CountJob& job : bound) if (job.ran != 1) FatalError( "A job for a node ran %i times.", (int)job.ran );
+	// a chain of diamonds: 0 before 1, 2 and 3, which all precede 4, and so on
+	TaskGraph graph;
+	vector<int> step( 301 );
+	vector<pair<int, int>> edges;
+	atomic<int> clock{ 0 };
+	for (int i = 0; i < 301; i++)
+	{
+		graph.Add( [&, i]() { step[i] = ++clock; } );
+		if (i % 4) edges.push_back( { i & ~3, i } );
+		else for (int j = max( 0, i - 3 ); j < i; j++) edges.push_back( { j, i } );
+	}
+	for (const pair<int, int>& e : edges) graph.Precede( e.first, e.second );
+	for (int run = 0; run < 10; run++)
+	{
+		clock = 0;
+		graph.Run();
+		if (clock != 301) FatalError( "TaskGraph: %i of 301 tasks ran.", (int)clock );
+		for (const pair<int, int>& e : edges) if (step[e.first] >= step[e.second]) FatalError( "TaskGraph: task %i ran before task %i.", e.second, e.first );
+	}
+}
+
+void RunBenchmarks()
+{
+	printf( "self-checks...\n" );
+	CheckScaleColor();
+	CheckJobSystem();
+	CheckKernelSources();
+	printf( "running benchmarks (best of %i runs)...\n", BENCH_RUNS );
+	BenchmarkLines();
+	BenchmarkGrid();
+	BenchmarkFill();
+	BenchmarkBlend();
+	BenchmarkSprites();
+	BenchmarkScaled();
+	BenchmarkDispatch();
+}
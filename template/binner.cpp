@@ -0,0 +1,121 @@
+// Template, IGAD version 3
+// Get the latest version from: https://github.com/jbikker/tmpl8
+// IGAD/NHTV/UU - Jacco Bikker - 2006-2023
+
+#include "precomp.h"
+
+// Binner implementation
+// ----------------------------------------------------------------------------
+
+Binner::Binner( Surface* s ) : target( s )
+{
+	tilesX = (s->width + TILESIZE - 1) / TILESIZE;
+	tilesY = (s->height + TILESIZE - 1) / TILESIZE;
+	for (int i = 0; i < CHUNKS; i++)
+	{
+		bins[i] = new vector<Prim>[tilesX * tilesY];
+		binJob[i].binner = this, binJob[i].idx = i;
+	}
+	// one tile per job; very large surfaces give a job several tiles
+	tileJobs = min( tilesX * tilesY, (int)MAXJOBS );
+	for (int i = 0; i < tileJobs; i++) tileJob[i].binner = this, tileJob[i].idx = i;
+}
+
+Binner::~Binner()
+{
+	for (int i = 0; i < CHUNKS; i++) delete[] bins[i];
+}
+
+// NaN x1 marks sprite commands; such lines would be rejected by clipping anyway
+void Binner::Line( float x1, float y1, float x2, float y2, uint c )
+{
+	if (!isnan( x1 )) commands.push_back( { x1, y1, x2, y2, c } );
+}
+
+void Binner::Lines( const float2* a, const float2* b, const int count, uint c )
+{
+	for (int i = 0; i < count; i++) Line( a[i].x, a[i].y, b[i].x, b[i].y, c );
+}
+
+// same layout and edge order as Surface::Grid
+void Binner::Grid( const float2* pos, const int stride, const int pitch, const int columns, const int rows, uint c )
+{
+	auto P = [&]( const int x, const int y ) -> const float2& { return *(const float2*)((const char*)pos + x * stride + y * pitch); };
+	commands.reserve( commands.size() + columns * rows * 2 );
+	for (int y = 0; y < rows; y++)
+	{
+		for (int x = 0; x < columns - 1; x++) Line( P( x, y ).x, P( x, y ).y, P( x + 1, y ).x, P( x + 1, y ).y, c );
+		if (y < rows - 1) for (int x = 0; x < columns; x++) Line( P( x, y ).x, P( x, y ).y, P( x, y + 1 ).x, P( x, y + 1 ).y, c );
+	}
+}
+
+void Binner::Draw( Sprite* sprite, int x, int y )
+{
+	commands.push_back( { NAN, (float)sprites.size(), (float)x, (float)y, 0 } );
+	sprites.push_back( { sprite, sprite->GetFrame() } );
+}
+
+// add a primitive to every tile overlapped by the pixel rectangle [x1, x2] x [y1, y2]
+void Binner::AddToBins( const int chunk, const Prim& p, int x1, int y1, int x2, int y2 )
+{
+	const int tx1 = x1 / TILESIZE, tx2 = min( tilesX - 1, x2 / TILESIZE );
+	const int ty1 = y1 / TILESIZE, ty2 = min( tilesY - 1, y2 / TILESIZE );
+	for (int ty = ty1; ty <= ty2; ty++) for (int tx = tx1; tx <= tx2; tx++) bins[chunk][tx + ty * tilesX].push_back( p );
+	int4& b = bounds[chunk];
+	b.x = min( b.x, x1 ), b.y = min( b.y, y1 ), b.z = max( b.z, x2 ), b.w = max( b.w, y2 );
+}
+
+// bin a contiguous chunk of the commands. Chunks are binned in parallel;
+// each has its own bins, so a tile replays them in recording order.
+void Binner::Bin( const int chunk )
+{
+	for (int i = 0; i < tilesX * tilesY; i++) bins[chunk][i].clear();
+	bounds[chunk] = int4( 0x7fffffff, 0x7fffffff, -1, -1 );
+	const size_t count = commands.size(), first = count * chunk / CHUNKS, last = count * (chunk + 1) / CHUNKS;
+	for (size_t i = first; i < last; i++)
+	{
+		const Command& cmd = commands[i];
+		float x1 = cmd.x1, y1 = cmd.y1, x2 = cmd.x2, y2 = cmd.y2;
+		if (isnan( x1 ))
+		{
+			// sprite: index in y1, position in x2, y2
+			const int idx = (int)y1, sx = (int)x2, sy = (int)y2;
+			Sprite* s = sprites[idx].sprite;
+			const int ex = sx + s->GetWidth() - 1, ey = sy + s->GetHeight() - 1;
+			if (sx >= target->width || sy >= target->height || ex < 0 || ey < 0) continue;
+			AddToBins( chunk, { sx, sy, -1, idx, 0 }, max( 0, sx ), max( 0, sy ), ex, ey );
+			continue;
+		}
+		// clip once, with the same arithmetic as Surface::Line
+		if (!target->ClipLine( x1, y1, x2, y2 )) continue;
+		const Prim p = { (int)x1, (int)y1, (int)x2, (int)y2, cmd.color };
+		AddToBins( chunk, p, min( p.x1, p.x2 ), min( p.y1, p.y2 ), max( p.x1, p.x2 ), max( p.y1, p.y2 ) );
+	}
+}
+
+void Binner::Rasterize( const int job )
+{
+	for (int tile = job; tile < tilesX * tilesY; tile += tileJobs)
+	{
+		const int x1 = (tile % tilesX) * TILESIZE, y1 = (tile / tilesX) * TILESIZE;
+		const int x2 = min( x1 + TILESIZE, target->width ), y2 = min( y1 + TILESIZE, target->height );
+		for (int chunk = 0; chunk < CHUNKS; chunk++) for (const Prim& p : bins[chunk][tile])
+		{
+			if (p.x2 >= 0) target->LineInRect( p.x1, p.y1, p.x2, p.y2, p.color, x1, y1, x2 - 1, y2 - 1 );
+			else sprites[p.y2].sprite->Draw( target, p.x1, p.y1, sprites[p.y2].frame, x1, y1, x2, y2 );
+		}
+	}
+}
+
+void Binner::Render()
+{
+	if (commands.empty()) return;
+	JobManager* jm = JobManager::GetJobManager();
+	for (int i = 0; i < CHUNKS; i++) jm->AddJob2( &binJob[i] );
+	jm->RunJobs();
+	for (int i = 0; i < CHUNKS; i++) target->MarkDirty( bounds[i].x, bounds[i].y, bounds[i].z, bounds[i].w );
+	for (int i = 0; i < tileJobs; i++) jm->AddJob2( &tileJob[i] );
+	jm->RunJobs();
+	commands.clear();
+	sprites.clear();
+}
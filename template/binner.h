@@ -0,0 +1,45 @@
+// Template, IGAD version 3
+// Get the latest version from: https://github.com/jbikker/tmpl8
+// IGAD/NHTV/UU - Jacco Bikker - 2006-2023
+
+#pragma once
+
+// Screen-space binning renderer. Lines and sprites are recorded, then
+// Render() sorts them into 64x64 pixel tiles and rasterizes the tiles in
+// parallel, one job per tile. Tiles are disjoint, so no locks are needed,
+// and commands are replayed in recording order, so the result is identical
+// to drawing them directly on the target.
+class Binner
+{
+public:
+	enum { TILESIZE = 64, CHUNKS = 16, MAXJOBS = 256 };
+	Binner( Tmpl8::Surface* target );
+	~Binner();
+	// recording
+	void Line( float x1, float y1, float x2, float y2, uint c );
+	void Lines( const float2* a, const float2* b, const int count, uint c );
+	void Grid( const float2* pos, const int stride, const int pitch, const int columns, const int rows, uint c );
+	void Draw( Tmpl8::Sprite* sprite, int x, int y );
+	// rasterize and clear the recorded commands
+	void Render();
+	Tmpl8::Surface* target;
+private:
+	// recorded line; sprites have a NaN x1, their index in y1 and position in x2, y2
+	struct Command { float x1, y1, x2, y2; uint color; };
+	struct SpriteRef { Tmpl8::Sprite* sprite; uint frame; };
+	// binned primitive in integer screen coordinates; x2 < 0 marks a sprite,
+	// with its index in y2.
+	struct Prim { int x1, y1, x2, y2; uint color; };
+	class BinJob : public Job { public: void Main() { binner->Bin( idx ); } Binner* binner; int idx; };
+	class TileJob : public Job { public: void Main() { binner->Rasterize( idx ); } Binner* binner; int idx; };
+	void Bin( const int chunk );
+	void Rasterize( const int job );
+	void AddToBins( const int chunk, const Prim& p, int x1, int y1, int x2, int y2 );
+	vector<Command> commands;
+	vector<SpriteRef> sprites;
+	vector<Prim>* bins[CHUNKS]; // per chunk of commands, per tile
+	int4 bounds[CHUNKS]; // per chunk: pixels touched, for the target's dirty region
+	BinJob binJob[CHUNKS];
+	TileJob tileJob[MAXJOBS];
+	int tilesX, tilesY, tileJobs;
+};
@@ -10,6 +10,25 @@
 #define SCRHEIGHT	720
 // #define FULLSCREEN
 
+// per-phase hardware performance counters (Linux only, see perfcounters.h)
+// #define PERFCOUNTERS
+
+// OpenCL command timing per kernel and per transfer, from event timestamps
+// (see Kernel::ProfileReport in opencl.h)
+// #define CL_PROFILING
+
+// pin the job system's threads to processors; without this, it runs one
+// unpinned thread per logical processor (see topology.h for the policies)
+// #define THREAD_PINNING	Topology::CORES
+
+// headless rendering: no window, OpenGL or OpenCL, which are then not
+// compiled in; HEADLESS_FRAMES frames are written to a file or sequence (see
+// framesink.h), or streamed to stdout with "-".
+// #define HEADLESS		"-"
+#ifndef HEADLESS_FRAMES
+#define HEADLESS_FRAMES	600
+#endif
+
 // constants
 #define PI			3.14159265358979323846264f
 #define INVPI		0.31830988618379067153777f
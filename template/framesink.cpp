@@ -0,0 +1,227 @@
+// Template, IGAD version 3
+// Get the latest version from: https://github.com/jbikker/tmpl8
+// IGAD/NHTV/UU - Jacco Bikker - 2006-2023
+
+#include "precomp.h"
+
+#ifdef _WIN32
+#include <fcntl.h>
+#define dup _dup
+#define dup2 _dup2
+#define fdopen _fdopen
+#define fileno _fileno
+#else
+#include <unistd.h>
+#endif
+
+// FrameSink implementation
+// ----------------------------------------------------------------------------
+
+FrameSink::FrameSink( const char* path, const int w, const int h, int f, const int rate ) : width( w ), height( h ), fps( rate )
+{
+	const char* ext = strrchr( path, '.' );
+	auto Is = [ext]( const char* e ) // case-insensitive extension test
+	{
+		for (int i = 0; ext; i++) if (tolower( ext[i] ) != e[i]) return false; else if (!e[i]) return true;
+		return false;
+	};
+	if (f == AUTO)
+	{
+		if (Is( ".png" )) f = PNG;
+		else if (Is( ".ppm" )) f = PPM;
+		else if (Is( ".raw" )) f = RAW;
+		else f = Y4M; // also for stdout: the header makes it self-describing
+	}
+	format = f;
+	if (format == PPM || format == PNG)
+	{
+		pattern = path;
+		if (!strchr( path, '%' )) pattern.insert( ext ? ext - path : pattern.size(), "%05i" );
+	}
+	else if (!strcmp( path, "-" ))
+	{
+		// keep the real stdout for the frames; everything else printed goes to stderr
+		fflush( stdout );
+		const int fd = dup( fileno( stdout ) );
+		dup2( fileno( stderr ), fileno( stdout ) );
+	#ifdef _WIN32
+		_setmode( fd, _O_BINARY );
+	#endif
+		out = fdopen( fd, "wb" );
+	}
+	else out = fopen( path, "wb" );
+	if ((format == RAW || format == Y4M) && !out) FatalError( "Could not open %s for writing.", path );
+	if (format == Y4M) fprintf( out, "YUV4MPEG2 W%i H%i F%i:1 Ip A1:1 C420jpeg\n", width, height, fps );
+	for (int i = 0; i < BUFFERS; i++) buffer[i] = (uint*)MALLOC64( width * height * sizeof( uint ) );
+	writer = thread( &FrameSink::WriterThread, this );
+}
+
+FrameSink::~FrameSink()
+{
+	{
+		lock_guard<mutex> l( lock );
+		stop = true;
+	}
+	filled.notify_one();
+	writer.join(); // the writer empties the queue before it stops
+	if (out) fclose( out );
+	for (int i = 0; i < BUFFERS; i++) FREE64( buffer[i] );
+	fprintf( stderr, "frame sink: %i frames written, %i dropped, %i failed\n", written - failed, dropped, failed );
+}
+
+// copy a frame into a free buffer; the copy is all the caller pays for
+bool FrameSink::Submit( const Surface* frame )
+{
+	if (frame->width != width || frame->height != height)
+		FatalError( "FrameSink: %ix%i frame submitted to a %ix%i sink.", frame->width, frame->height, width, height );
+	int slot;
+	{
+		unique_lock<mutex> l( lock );
+		if (count == BUFFERS)
+		{
+			if (!blocking) { dropped++; return false; }
+			emptied.wait( l, [this]() { return count < BUFFERS; } );
+		}
+		// the writer only touches filled buffers, so this one is ours until count changes
+		slot = (head + count) % BUFFERS;
+	}
+	uint* dst = buffer[slot];
+	for (int y = 0; y < height; y++) memcpy( dst + y * width, frame->pixels + y * frame->pitch, width * sizeof( uint ) );
+	{
+		lock_guard<mutex> l( lock );
+		count++, submitted++;
+	}
+	filled.notify_one();
+	return true;
+}
+
+// wait until all submitted frames are written
+void FrameSink::Flush()
+{
+	unique_lock<mutex> l( lock );
+	emptied.wait( l, [this]() { return count == 0; } );
+	if (out) fflush( out );
+}
+
+void FrameSink::WriterThread()
+{
+	while (1)
+	{
+		int slot;
+		{
+			unique_lock<mutex> l( lock );
+			filled.wait( l, [this]() { return count > 0 || stop; } );
+			if (count == 0) return; // stopped, and nothing left to write
+			slot = head;
+		}
+		const bool ok = Write( buffer[slot], written );
+		{
+			lock_guard<mutex> l( lock );
+			head = (head + 1) % BUFFERS, count--, written++, failed += !ok;
+		}
+		emptied.notify_all();
+	}
+}
+
+bool FrameSink::Write( const uint* frame, const int idx )
+{
+	if (format == RAW) { fwrite( frame, 4, width * height, out ); return true; } // bgr0 in memory order
+	if (format == Y4M) { WriteY4M( frame ); return true; }
+	char name[1024];
+	snprintf( name, sizeof( name ), pattern.c_str(), idx );
+	if (format == PNG && !DeflatePNG( frame ))
+	{
+		// no file rather than one with a broken image
+		fprintf( stderr, "frame sink: compressing %s failed; frame dropped\n", name );
+		return false;
+	}
+	FILE* f = fopen( name, "wb" );
+	if (!f) FatalError( "Could not open %s for writing.", name );
+	if (format == PNG) WritePNG( f ); else
+	{
+		fprintf( f, "P6\n%i %i\n255\n", width, height );
+		scratch.resize( width * height * 3 );
+		for (int i = 0; i < width * height; i++)
+		{
+			const uint c = frame[i];
+			scratch[i * 3] = (uchar)(c >> 16), scratch[i * 3 + 1] = (uchar)(c >> 8), scratch[i * 3 + 2] = (uchar)c;
+		}
+		fwrite( scratch.data(), 1, scratch.size(), f );
+	}
+	fclose( f );
+	return true;
+}
+
+// BT.601 limited range; chroma from the average of each 2x2 block, which is
+// what 'C420jpeg' (centered chroma) describes.
+void FrameSink::WriteY4M( const uint* frame )
+{
+	const int cw = (width + 1) / 2, ch = (height + 1) / 2;
+	scratch.resize( width * height + 2 * cw * ch );
+	uchar* Y = scratch.data(), * U = Y + width * height, * V = U + cw * ch;
+	for (int i = 0; i < width * height; i++)
+	{
+		const int r = (frame[i] >> 16) & 255, g = (frame[i] >> 8) & 255, b = frame[i] & 255;
+		Y[i] = (uchar)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+	}
+	for (int y = 0; y < ch; y++) for (int x = 0; x < cw; x++)
+	{
+		int r = 0, g = 0, b = 0, n = 0;
+		for (int v = y * 2; v < min( y * 2 + 2, height ); v++) for (int u = x * 2; u < min( x * 2 + 2, width ); u++, n++)
+		{
+			const uint c = frame[u + v * width];
+			r += (c >> 16) & 255, g += (c >> 8) & 255, b += c & 255;
+		}
+		r /= n, g /= n, b /= n;
+		U[x + y * cw] = (uchar)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+		V[x + y * cw] = (uchar)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+	}
+	fwrite( "FRAME\n", 1, 6, out );
+	fwrite( scratch.data(), 1, scratch.size(), out );
+}
+
+// 8-bit RGB PNG: rows with the 'sub' filter, deflated in a single IDAT chunk,
+// which DeflatePNG leaves in scratch for WritePNG
+bool FrameSink::DeflatePNG( const uint* frame )
+{
+	const int stride = 1 + width * 3;
+	vector<uchar> rows( stride * height );
+	for (int y = 0; y < height; y++)
+	{
+		uchar* row = rows.data() + y * stride;
+		row[0] = 1; // filter type: difference with the pixel to the left
+		for (uint x = 0, prev = 0; x < (uint)width; x++)
+		{
+			const uint c = frame[x + y * width];
+			row[1 + x * 3] = (uchar)((c >> 16) - (prev >> 16));
+			row[2 + x * 3] = (uchar)((c >> 8) - (prev >> 8));
+			row[3 + x * 3] = (uchar)(c - prev);
+			prev = c;
+		}
+	}
+	uLongf size = compressBound( (uLong)rows.size() );
+	scratch.resize( size );
+	if (compress2( scratch.data(), &size, rows.data(), (uLong)rows.size(), Z_BEST_SPEED ) != Z_OK) return false;
+	scratch.resize( size );
+	return true;
+}
+
+void FrameSink::WritePNG( FILE* f )
+{
+	auto BE32 = []( uchar* p, const uint v ) { p[0] = (uchar)(v >> 24), p[1] = (uchar)(v >> 16), p[2] = (uchar)(v >> 8), p[3] = (uchar)v; };
+	auto Chunk = [&]( const char* type, const uchar* data, const uint length )
+	{
+		uchar t[8];
+		BE32( t, length ), memcpy( t + 4, type, 4 );
+		fwrite( t, 1, 8, f ), fwrite( data, 1, length, f );
+		BE32( t, (uint)crc32( crc32( 0, t + 4, 4 ), data, length ) );
+		fwrite( t, 1, 4, f );
+	};
+	static const uchar signature[8] = { 137, 'P', 'N', 'G', 13, 10, 26, 10 };
+	uchar header[13] = { 0, 0, 0, 0, 0, 0, 0, 0, 8, 2, 0, 0, 0 }; // 8 bits per channel, RGB
+	BE32( header, width ), BE32( header + 4, height );
+	fwrite( signature, 1, 8, f );
+	Chunk( "IHDR", header, 13 );
+	Chunk( "IDAT", scratch.data(), (uint)scratch.size() );
+	Chunk( "IEND", header, 0 ); // crc32 of a null pointer is 0, not the crc of nothing
+}
@@ -0,0 +1,45 @@
+// Template, IGAD version 3
+// Get the latest version from: https://github.com/jbikker/tmpl8
+// IGAD/NHTV/UU - Jacco Bikker - 2006-2023
+
+#pragma once
+
+// Headless frame output. Submit copies a surface into one of a few recycled
+// buffers and returns; a background thread encodes the frames and writes
+// them as a raw (bgr0) or Y4M (4:2:0) stream, or as a numbered PPM or PNG
+// sequence. Streams can go to stdout ("-") for piping into an encoder, e.g.
+//   app | ffmpeg -i - cloth.mp4
+// stdout is then reserved for the frames; printf output goes to stderr.
+// When all buffers are in use, Submit drops the frame, so Tick never waits
+// for the disk; set 'blocking' to keep every frame instead.
+class FrameSink
+{
+public:
+	enum { AUTO = 0, RAW, Y4M, PPM, PNG }; // AUTO: from the file extension
+	enum { BUFFERS = 4 };
+	// sequences: path is a printf pattern for the frame number, such as
+	// "frames/%05i.png"; without one, the number goes before the extension.
+	FrameSink( const char* path, const int width, const int height, int format = AUTO, const int fps = 60 );
+	~FrameSink(); // writes the queued frames
+	bool Submit( const Tmpl8::Surface* frame ); // false if the frame was dropped
+	void Flush();
+	bool blocking = false;
+	int submitted = 0, dropped = 0;
+private:
+	void WriterThread();
+	bool Write( const uint* frame, const int idx ); // false if the frame could not be encoded
+	void WriteY4M( const uint* frame );
+	bool DeflatePNG( const uint* frame );
+	void WritePNG( FILE* f );
+	int width, height, format, fps;
+	string pattern; // for sequences
+	FILE* out = 0; // for streams
+	uint* buffer[BUFFERS];
+	int head = 0, count = 0, written = 0; // ring of filled buffers
+	int failed = 0; // taken from the ring, but not written
+	bool stop = false;
+	mutex lock;
+	condition_variable filled, emptied;
+	thread writer;
+	vector<uchar> scratch; // encoder output, used by the writer thread only
+};
@@ -0,0 +1,112 @@
+// Template, IGAD version 3
+// Get the latest version from: https://github.com/jbikker/tmpl8
+// IGAD/NHTV/UU - Jacco Bikker - 2006-2023
+
+#include "precomp.h"
+
+// Histogram implementation
+// ----------------------------------------------------------------------------
+
+// values below SUBCOUNT get a bucket each; above that, every power of two is
+// split in HALF linear sub-buckets, so the bucket width grows with the value.
+uint Histogram::Index( const uint64_t us )
+{
+	uint e = 0;
+	while ((us >> e) >= SUBCOUNT) e++;
+	return e * HALF + (uint)(us >> e);
+}
+
+uint64_t Histogram::HighestEquivalent( const uint index )
+{
+	const uint e = index < SUBCOUNT ? 0 : (index / HALF - 1);
+	const uint64_t sub = index - e * HALF;
+	return ((sub + 1) << e) - 1;
+}
+
+void Histogram::Record( const float ms )
+{
+	if (!(ms >= 0)) return; // also rejects NaN
+	const uint64_t us = (uint64_t)min( ms * 1000.0 + 0.5, 4294967295.0 );
+	bucket[Index( us )]++;
+	count++, total += us;
+	if (us > maxValue) maxValue = us;
+}
+
+void Histogram::Reset()
+{
+	memset( bucket, 0, sizeof( bucket ) );
+	count = total = maxValue = 0;
+}
+
+float Histogram::Percentile( const float p ) const
+{
+	if (count == 0) return 0;
+	const uint64_t target = max( (uint64_t)1, (uint64_t)ceil( p * 0.01 * (double)count ) );
+	uint64_t seen = 0;
+	for (uint i = 0; i < BUCKETS; i++) if ((seen += bucket[i]) >= target)
+		return min( HighestEquivalent( i ), maxValue ) * 0.001f;
+	return Max();
+}
+
+void Histogram::Print( const char* name ) const
+{
+	printf( "%-10s n=%-8llu mean %7.2f  p50 %7.2f  p95 %7.2f  p99 %7.2f  max %7.2f ms\n", name,
+		(unsigned long long)count, Mean(), Percentile( 50 ), Percentile( 95 ), Percentile( 99 ), Max() );
+}
+
+void Histogram::WriteJSON( FILE* f, const char* name ) const
+{
+	fprintf( f, "\t\"%s\": {\n\t\t\"count\": %llu, \"mean_ms\": %.3f, \"p50_ms\": %.3f, \"p95_ms\": %.3f, \"p99_ms\": %.3f, \"max_ms\": %.3f,\n",
+		name, (unsigned long long)count, Mean(), Percentile( 50 ), Percentile( 95 ), Percentile( 99 ), Max() );
+	// non-empty buckets only, as [upper bound in ms, count]
+	fprintf( f, "\t\t\"buckets\": [" );
+	bool first = true;
+	for (uint i = 0; i < BUCKETS; i++) if (bucket[i])
+	{
+		fprintf( f, "%s[%.3f, %llu]", first ? "" : ", ", HighestEquivalent( i ) * 0.001f, (unsigned long long)bucket[i] );
+		first = false;
+	}
+	fprintf( f, "]\n\t}" );
+}
+
+// FrameStats implementation
+// ----------------------------------------------------------------------------
+
+FrameStats& GetFrameStats()
+{
+	static FrameStats stats;
+	return stats;
+}
+
+const char* FrameStats::Name( const uint idx )
+{
+	static const char* name[COUNT] = { "frame", "simulation", "draw" };
+	return idx < COUNT ? name[idx] : "?";
+}
+
+char* FrameStats::Overlay( char* t ) const
+{
+	for (uint i = 0; i < COUNT; i++)
+	{
+		const Histogram& h = histogram[i];
+		t += sprintf( t, "%10s: p50 %6.1f  p95 %6.1f  p99 %6.1f  max %6.1f ms\n", Name( i ),
+			h.Percentile( 50 ), h.Percentile( 95 ), h.Percentile( 99 ), h.Max() );
+	}
+	return t;
+}
+
+void FrameStats::Dump( const char* jsonFile ) const
+{
+	printf( "frame time statistics:\n" );
+	for (uint i = 0; i < COUNT; i++) histogram[i].Print( Name( i ) );
+	FILE* f = fopen( jsonFile, "w" );
+	if (!f) return;
+	fprintf( f, "{\n" );
+	for (uint i = 0; i < COUNT; i++)
+	{
+		histogram[i].WriteJSON( f, Name( i ) );
+		fprintf( f, i < COUNT - 1 ? ",\n" : "\n" );
+	}
+	fprintf( f, "}\n" );
+	fclose( f );
+}
@@ -0,0 +1,41 @@
+// Template, IGAD version 3
+// Get the latest version from: https://github.com/jbikker/tmpl8
+// IGAD/NHTV/UU - Jacco Bikker - 2006-2023
+
+#pragma once
+
+// HDR-style histogram of durations: log-linear buckets with a fixed relative
+// precision (~1.5%), covering 1us to over an hour in a few KB. Recording is
+// a handful of shifts and an increment, so it is cheap enough for every frame.
+class Histogram
+{
+public:
+	enum { SUBBITS = 7, SUBCOUNT = 1 << SUBBITS, HALF = SUBCOUNT / 2, BUCKETS = (32 - SUBBITS + 2) * HALF };
+	void Record( const float ms );
+	void Reset();
+	uint64_t Count() const { return count; }
+	float Percentile( const float p ) const;
+	float Mean() const { return count ? (float)total * 0.001f / count : 0; }
+	float Max() const { return maxValue * 0.001f; }
+	void Print( const char* name ) const;
+	void WriteJSON( FILE* f, const char* name ) const;
+private:
+	static uint Index( const uint64_t us );
+	static uint64_t HighestEquivalent( const uint index );
+	uint64_t bucket[BUCKETS] = {};
+	uint64_t count = 0, total = 0, maxValue = 0; // in microseconds
+};
+
+// frame, simulation and draw time distributions; recorded by the main loop
+// (frame) and the application (simulation, draw). Dumped to the console and
+// framestats.json on exit.
+struct FrameStats
+{
+	enum { FRAME = 0, SIMULATION, DRAW, COUNT };
+	Histogram histogram[COUNT];
+	void Record( const uint idx, const float ms ) { histogram[idx].Record( ms ); }
+	char* Overlay( char* t ) const; // appends one line per histogram, returns the end
+	void Dump( const char* jsonFile ) const;
+	static const char* Name( const uint idx );
+};
+FrameStats& GetFrameStats();
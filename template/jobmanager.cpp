@@ -0,0 +1,391 @@
+// Template, IGAD version 3
+// Get the latest version from: https://github.com/jbikker/tmpl8
+// IGAD/NHTV/UU - Jacco Bikker - 2006-2023
+
+#include "precomp.h"
+
+// JobDeque implementation
+// ----------------------------------------------------------------------------
+
+JobDeque::JobDeque() : top( 0 ), bottom( 0 ), array( new Array( 256 ) ) {}
+
+JobDeque::~JobDeque()
+{
+	for (Array* a : retired) delete a;
+	delete array.load();
+}
+
+void JobDeque::Push( Job* job )
+{
+	const int64_t b = bottom.load( memory_order_relaxed ), t = top.load( memory_order_acquire );
+	Array* a = array.load( memory_order_relaxed );
+	if (b - t > a->size - 1)
+	{
+		// full: copy the live range to an array twice the size
+		Array* larger = new Array( a->size * 2 );
+		for (int64_t i = t; i < b; i++) (*larger)[i].store( (*a)[i].load( memory_order_relaxed ), memory_order_relaxed );
+		retired.push_back( a );
+		array.store( a = larger, memory_order_release );
+	}
+	(*a)[b].store( job, memory_order_relaxed );
+	bottom.store( b + 1, memory_order_release ); // publishes the job to thieves
+}
+
+Job* JobDeque::Pop()
+{
+	const int64_t b = bottom.load( memory_order_relaxed ) - 1;
+	Array* a = array.load( memory_order_relaxed );
+	bottom.store( b, memory_order_relaxed );
+	atomic_thread_fence( memory_order_seq_cst );
+	int64_t t = top.load( memory_order_relaxed );
+	Job* job = 0;
+	if (t <= b)
+	{
+		job = (*a)[b].load( memory_order_relaxed );
+		if (t == b)
+		{
+			// last job: race the thieves for it
+			if (!top.compare_exchange_strong( t, t + 1, memory_order_seq_cst, memory_order_relaxed )) job = 0;
+			bottom.store( b + 1, memory_order_relaxed );
+		}
+	}
+	else bottom.store( b + 1, memory_order_relaxed ); // empty
+	return job;
+}
+
+Job* JobDeque::Steal()
+{
+	int64_t t = top.load( memory_order_acquire );
+	atomic_thread_fence( memory_order_seq_cst );
+	const int64_t b = bottom.load( memory_order_acquire );
+	if (t >= b) return 0; // empty
+	Job* job = (*array.load( memory_order_acquire ))[t].load( memory_order_relaxed );
+	// lost against the owner or another thief
+	if (!top.compare_exchange_strong( t, t + 1, memory_order_seq_cst, memory_order_relaxed )) return 0;
+	return job;
+}
+
+// JobManager implementation
+// ----------------------------------------------------------------------------
+
+// gaps between batches up to this long are worth spinning through; spins
+// are never shorter than a wake-up from the kernel takes anyway
+#define MAX_SPIN_NS	200000
+#define MIN_SPIN_NS	20000
+
+void Job::RunCodeWrapper()
+{
+	Main();
+}
+
+JobManager* JobManager::m_JobManager = 0;
+
+void JobThread::CreateAndStartThread( unsigned int threadId )
+{
+	m_ThreadID = threadId;
+	m_Seed = 0x9e3779b9u * (threadId + 1);
+	if (threadId > 0) m_Thread = thread( &JobThread::BackgroundTask, this );
+}
+
+void JobThread::BackgroundTask()
+{
+	JobManager* jm = JobManager::GetJobManager();
+	JobManager::m_ThreadIdx = m_ThreadID;
+	if (m_CPU >= 0) Topology::PinCurrentThread( Topology::Get().cpus[m_CPU] );
+#ifdef PERFCOUNTERS
+	PerfCounters::AddThread(); // phases count the work of all threads
+#endif
+	uint64_t generation = 0;
+	int64_t batch = 0;
+	while (1)
+	{
+		const bool parked = jm->Wait( m_ThreadID, generation );
+		if (jm->m_Stop) return;
+		generation = jm->m_Generation; // before looking for jobs, so none is missed
+		const int64_t batches = jm->m_Batches.load( memory_order_relaxed );
+		if (batches != batch)
+		{
+			// the first wake-up for this batch
+			batch = batches;
+			jm->m_WakeNs.fetch_add( JobTrace::Now() - jm->m_BatchStart.load( memory_order_relaxed ), memory_order_relaxed );
+			jm->m_Wakes.fetch_add( 1, memory_order_relaxed );
+			if (parked) jm->m_Parks.fetch_add( 1, memory_order_relaxed );
+		}
+		jm->Work( m_ThreadID );
+	}
+}
+
+JobManager::JobManager( unsigned int threads ) : m_NumThreads( max( 1u, threads ) ) {}
+
+JobManager::~JobManager()
+{
+	m_Stop = true;
+	{
+		lock_guard<mutex> lock( m_Lock );
+		m_Go.notify_all();
+	}
+	for (unsigned int i = 1; i < m_NumThreads; i++) m_JobThreadList[i].m_Thread.join();
+	delete[] m_JobThreadList;
+	delete[] m_NodeQueue;
+	delete m_Trace;
+}
+
+void JobManager::CreateJobManager( unsigned int numThreads, const int pinning )
+{
+	JobManager* jm = m_JobManager = new JobManager( numThreads );
+	jm->m_JobThreadList = new JobThread[jm->m_NumThreads];
+	if (pinning != Topology::NONE)
+	{
+		// thread i gets the i-th processor of the policy; more threads than
+		// processors wrap around. Nodes without threads get no number.
+		const Topology& topology = Topology::Get();
+		const vector<int> order = topology.Order( pinning );
+		vector<int> node( topology.nodes, -1 );
+		jm->m_NumNodes = 0;
+		for (unsigned int i = 0; i < jm->m_NumThreads; i++)
+		{
+			JobThread& t = jm->m_JobThreadList[i];
+			t.m_CPU = order[i % order.size()];
+			const int n = topology.cpus[t.m_CPU].node;
+			if (node[n] < 0) node[n] = jm->m_NumNodes++;
+			t.m_Node = node[n];
+		}
+		Topology::PinCurrentThread( topology.cpus[jm->m_JobThreadList[0].m_CPU] ); // thread 0 is the caller
+	}
+	jm->m_NodeQueue = new NodeQueue[jm->m_NumNodes];
+	jm->m_CanSpin = jm->m_NumThreads <= Topology::Get().cpus.size();
+	for (unsigned int i = 0; i < jm->m_NumThreads; i++) jm->m_JobThreadList[i].CreateAndStartThread( i );
+}
+
+void JobManager::AddJob2( Job* a_Job, int node )
+{
+	m_Pending.fetch_add( 1, memory_order_relaxed );
+	if (node >= 0) node %= m_NumNodes;
+	if (m_ThreadIdx < 0)
+	{
+		// from outside a job: the workers take it from a queue; RunJobs wakes them
+		NodeQueue& queue = node < 0 ? m_Inject : m_NodeQueue[node];
+		lock_guard<mutex> lock( queue.lock );
+		queue.jobs.push_back( a_Job );
+		queue.size.fetch_add( 1, memory_order_release );
+		return;
+	}
+	// from a job: the deque of the thread running it, if that is on the right node
+	if (node < 0 || node == m_JobThreadList[m_ThreadIdx].m_Node) m_JobThreadList[m_ThreadIdx].m_Jobs.Push( a_Job ); else
+	{
+		NodeQueue& queue = m_NodeQueue[node];
+		lock_guard<mutex> lock( queue.lock );
+		queue.jobs.push_back( a_Job );
+		queue.size.fetch_add( 1, memory_order_release );
+	}
+	// wake a thread to help; a sleeper counts itself before it checks m_Generation
+	m_Generation++;
+	if (m_Sleepers > 0)
+	{
+		lock_guard<mutex> lock( m_Lock );
+		m_Go.notify_one();
+	}
+}
+
+Job* JobManager::TakeFrom( NodeQueue& queue )
+{
+	if (queue.size.load( memory_order_acquire ) == 0) return 0;
+	lock_guard<mutex> lock( queue.lock );
+	if (queue.jobs.empty()) return 0;
+	Job* job = queue.jobs.front();
+	queue.jobs.pop_front();
+	queue.size.fetch_sub( 1, memory_order_relaxed );
+	return job;
+}
+
+// own deque first, then the jobs for this node, then the jobs added outside
+// a job, then steal, starting at a random victim on the same node; other
+// nodes come last.
+Job* JobManager::GetNextJob( unsigned int threadId )
+{
+	JobThread& self = m_JobThreadList[threadId];
+	if (Job* job = self.m_Jobs.Pop()) return job;
+	if (Job* job = TakeFrom( m_NodeQueue[self.m_Node] )) return job;
+	if (Job* job = TakeFrom( m_Inject )) return job;
+	const unsigned int first = RandomUInt( self.m_Seed ) % m_NumThreads;
+	for (int remote = 0; remote < (m_NumNodes > 1 ? 2 : 1); remote++) for (unsigned int i = 0; i < m_NumThreads; i++)
+	{
+		const unsigned int victim = (first + i) % m_NumThreads;
+		if (victim == threadId || (m_JobThreadList[victim].m_Node != self.m_Node) != (remote == 1)) continue;
+		if (Job* job = m_JobThreadList[victim].m_Jobs.Steal()) { Trace( threadId, JobTrace::STEAL, victim ); return job; }
+	}
+	for (unsigned int i = 1; i < m_NumNodes; i++) if (Job* job = TakeFrom( m_NodeQueue[(self.m_Node + i) % m_NumNodes] )) return job;
+	return 0;
+}
+
+// run jobs until none can be found
+void JobManager::Work( unsigned int threadId )
+{
+	while (Job* job = GetNextJob( threadId ))
+	{
+		Trace( threadId, JobTrace::JOB_BEGIN );
+		job->RunCodeWrapper();
+		Trace( threadId, JobTrace::JOB_END ); // before the job counts as done
+		if (m_Pending.fetch_sub( 1 ) == 1 && m_Joining)
+		{
+			// the last one: wake the caller of RunJobs
+			lock_guard<mutex> lock( m_Lock );
+			m_Done.notify_one();
+		}
+	}
+}
+
+// wait until m_Generation differs from 'generation', for thread 0 (the caller
+// of RunJobs) also until all jobs completed: spin if that is expected soon,
+// then park. Returns true if the thread parked.
+bool JobManager::Wait( unsigned int threadId, const uint64_t generation )
+{
+	auto Ready = [&]() { return m_Generation != generation || m_Stop || (threadId == 0 && m_Pending == 0); };
+#ifdef PERFCOUNTERS
+	PerfCounters::Pause(); // phases count work, not waiting
+#endif
+	// the clock is read once every 64 pauses
+	int64_t spin = m_SpinNs.load( memory_order_relaxed );
+	if (m_CanSpin && m_Pending.load( memory_order_relaxed ) > 0) spin = max( spin, (int64_t)MIN_SPIN_NS );
+	const int64_t start = spin > 0 ? JobTrace::Now() : 0;
+	bool ready = false;
+	if (spin > 0) Trace( threadId, JobTrace::SPIN );
+	for (int i = 1; spin > 0 && !(ready = Ready()); i++)
+	{
+		_mm_pause();
+		if ((i & 63) == 0 && JobTrace::Now() - start > spin) break;
+	}
+	if (!ready)
+	{
+		// park; notifiers only take the lock when someone sleeps
+		unique_lock<mutex> lock( m_Lock );
+		Trace( threadId, JobTrace::PARK );
+		if (threadId == 0) { m_Joining = true; m_Done.wait( lock, Ready ); m_Joining = false; }
+		else { m_Sleepers++; m_Go.wait( lock, Ready ); m_Sleepers--; }
+	}
+	Trace( threadId, JobTrace::WAKE );
+#ifdef PERFCOUNTERS
+	PerfCounters::Resume();
+#endif
+	return !ready;
+}
+
+void JobManager::RunJobs()
+{
+	if (m_Pending.load() == 0) return;
+	const int64_t start = JobTrace::Now();
+	if (m_CanSpin && m_BatchEnd > 0)
+	{
+		// spin for twice the typical short gap, if most gaps are short
+		const int64_t gap = start - m_BatchEnd;
+		m_ShortGaps = 0.9f * m_ShortGaps + (gap < MAX_SPIN_NS ? 0.1f : 0);
+		if (gap < MAX_SPIN_NS) m_GapNs = 0.9f * m_GapNs + 0.1f * gap;
+		m_SpinNs.store( m_ShortGaps > 0.5f ? (int64_t)clamp( 2 * m_GapNs, (float)MIN_SPIN_NS, (float)MAX_SPIN_NS ) : 0, memory_order_relaxed );
+	}
+	m_BatchStart.store( start, memory_order_relaxed );
+	Trace( 0, JobTrace::BATCH_BEGIN );
+	m_Batches.fetch_add( 1, memory_order_relaxed );
+	m_Generation++; // a sleeper counts itself before it checks this, so one of both sees the other
+	if (m_Sleepers > 0)
+	{
+		lock_guard<mutex> lock( m_Lock );
+		m_Go.notify_all();
+	}
+	// help until all jobs completed; workers that are still looking for jobs
+	// by then are not waited for
+	m_ThreadIdx = 0;
+	while (1)
+	{
+		const uint64_t generation = m_Generation;
+		Work( 0 );
+		if (m_Pending == 0) break;
+		Wait( 0, generation );
+	}
+	m_ThreadIdx = -1;
+	if (m_Tracing) Trace( 0, JobTrace::BATCH_END ), m_Trace->Collect();
+	m_BatchEnd = JobTrace::Now();
+}
+
+void JobManager::StartTrace()
+{
+	if (!m_Trace) m_Trace = new JobTrace( m_NumThreads );
+	m_Trace->Restart();
+	m_Tracing = true;
+}
+
+void JobManager::StopTrace( const char* path )
+{
+	if (!m_Tracing) return;
+	m_Tracing = false;
+	m_Trace->Collect();
+	if (m_Trace->Write( path )) printf( "job trace written to %s\n", path );
+	else printf( "could not write the job trace to %s\n", path );
+	vector<char> summary( 256 + 128 * m_NumThreads );
+	m_Trace->Summary( summary.data() );
+	printf( "%s", summary.data() );
+}
+
+char* JobManager::Report( char* t )
+{
+	const int64_t now[4] = { m_Batches, m_Wakes, m_WakeNs, m_Parks };
+	const int64_t batches = now[0] - m_Reported[0], wakes = now[1] - m_Reported[1], ns = now[2] - m_Reported[2], parks = now[3] - m_Reported[3];
+	memcpy( m_Reported, now, sizeof( now ) );
+	return t + sprintf( t, "jobs: %i batches, wake %5.1f us, %3i%% parked, spin %5.1f us\n", (int)batches,
+		wakes > 0 ? ns * 1e-3f / wakes : 0, wakes > 0 ? (int)(parks * 100 / wakes) : 0, m_SpinNs * 1e-3f );
+}
+
+// TaskGraph implementation
+// ----------------------------------------------------------------------------
+
+int TaskGraph::Add( function<void()> work, const int node )
+{
+	Task& task = tasks.emplace_back();
+	task.graph = this, task.work = move( work ), task.node = node;
+	return (int)tasks.size() - 1;
+}
+
+void TaskGraph::Precede( const int before, const int after )
+{
+	tasks[before].successors.push_back( &tasks[after] );
+	tasks[after].inputs++;
+}
+
+void TaskGraph::Task::Main()
+{
+	work();
+	graph->completed.fetch_add( 1, memory_order_relaxed );
+	// the last predecessor to complete queues the task, on its own deque; it
+	// is counted as pending before this task is, so RunJobs keeps waiting.
+	JobManager* jm = JobManager::GetJobManager();
+	for (Task* next : successors) if (next->waiting.fetch_sub( 1, memory_order_acq_rel ) == 1) jm->AddJob2( next, next->node );
+}
+
+void TaskGraph::Run()
+{
+	JobManager* jm = JobManager::GetJobManager();
+	completed = 0;
+	for (Task& task : tasks) task.waiting.store( task.inputs, memory_order_relaxed );
+	for (Task& task : tasks) if (task.inputs == 0) jm->AddJob2( &task, task.node );
+	jm->RunJobs();
+	if (completed != (int)tasks.size()) FatalError( "TaskGraph: %i of %i tasks never ran; the graph has a cycle.", (int)tasks.size() - completed, (int)tasks.size() );
+}
+
+void JobManager::GetProcessorCount( uint& cores, uint& logical )
+{
+	const Topology& topology = Topology::Get();
+	cores = topology.cores, logical = (uint)topology.cpus.size();
+}
+
+JobManager* JobManager::GetJobManager()
+{
+	if (!m_JobManager)
+	{
+	#ifdef THREAD_PINNING
+		const int pinning = THREAD_PINNING;
+	#else
+		const int pinning = Topology::NONE;
+	#endif
+		CreateJobManager( (uint)Topology::Get().Order( pinning ).size(), pinning );
+	}
+	return m_JobManager;
+}
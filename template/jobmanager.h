@@ -0,0 +1,229 @@
+// Template, IGAD version 3
+// Get the latest version from: https://github.com/jbikker/tmpl8
+// IGAD/NHTV/UU - Jacco Bikker - 2006-2023
+
+#pragma once
+
+// Nils's jobmanager, on std::thread with work stealing. Every thread owns a
+// deque of jobs: it pushes and pops at the bottom without locks, and threads
+// that run out of work steal from the top of other deques. The thread that
+// calls RunJobs works along, so GetNumThreads includes it.
+// Usage is unchanged: AddJob2 any number of jobs, then RunJobs to execute
+// them and wait for completion. Jobs added from outside a job go to a
+// shared queue with a lock, which all threads take from. Jobs may add jobs
+// themselves; these go to the deque of the thread that runs them, and
+// RunJobs waits for them too. RunJobs must not be called from a job.
+// With a pinning policy (see topology.h), every thread is pinned to its own
+// logical processor, and jobs can be bound to a NUMA node: they then run
+// on threads of that node, unless all of those are busy. Threads that run
+// out of work steal on their own node first.
+// A thread without work spins for a while before it sleeps: most batches
+// follow the previous one within microseconds, and waking a thread from
+// the kernel takes longer than that. The spin time follows the gaps seen
+// between batches; when gaps are long, workers sleep right away. Within a
+// batch, threads spin at least as long as a wake-up takes.
+class Job
+{
+public:
+	virtual void Main() = 0;
+protected:
+	friend class JobManager;
+	void RunCodeWrapper();
+};
+
+// Chase-Lev work-stealing deque, with the memory orderings of Le et al.,
+// "Correct and Efficient Work-Stealing for Weak Memory Models" (2013), with
+// a release store instead of a release fence in Push.
+// Push and Pop are for the owner only; any thread may Steal. A full deque
+// doubles in size; the old array is kept until the deque is destroyed, as
+// RunJobs does not wait for thieves that are still looking for work.
+class JobDeque
+{
+public:
+	JobDeque();
+	~JobDeque();
+	void Push( Job* job );
+	Job* Pop();
+	Job* Steal();
+private:
+	struct Array
+	{
+		Array( int64_t n ) : size( n ), slot( new atomic<Job*>[n] ) {}
+		~Array() { delete[] slot; }
+		atomic<Job*>& operator[]( int64_t i ) { return slot[i & (size - 1)]; }
+		int64_t size;
+		atomic<Job*>* slot;
+	};
+	alignas( 64 ) atomic<int64_t> top;		// thieves take from here
+	alignas( 64 ) atomic<int64_t> bottom;	// the owner works here
+	atomic<Array*> array;
+	vector<Array*> retired;
+};
+
+class JobThread
+{
+public:
+	void CreateAndStartThread( unsigned int threadId );
+	void BackgroundTask();
+	JobDeque m_Jobs;
+	thread m_Thread;
+	unsigned int m_ThreadID;
+	uint m_Seed; // for picking steal victims
+	int m_CPU = -1; // index in Topology::cpus if pinned
+	int m_Node = 0; // among the nodes that have threads
+};
+
+class JobManager	// singleton class!
+{
+protected:
+	JobManager( unsigned int numThreads );
+public:
+	~JobManager();
+	static void CreateJobManager( unsigned int numThreads, const int pinning = Topology::NONE );
+	static JobManager* GetJobManager();
+	static void GetProcessorCount( uint& cores, uint& logical );
+	void AddJob2( Job* a_Job, int node = -1 ); // node: run it there if possible; taken modulo GetNumNodes
+	unsigned int GetNumNodes() { return m_NumNodes; }
+	unsigned int GetNumThreads() { return m_NumThreads; }
+	void RunJobs();
+	int MaxConcurrent() { return m_NumThreads; }
+	static bool InJob() { return m_ThreadIdx >= 0; }
+	char* Report( char* t ); // appends dispatch statistics since the previous report, returns the end
+	// timeline recording (see jobtrace.h); not while RunJobs runs
+	void StartTrace();
+	void StopTrace( const char* path ); // writes the trace, prints a summary
+	bool Tracing() { return m_Tracing; }
+protected:
+	friend class JobThread;
+	friend class TaskGraph;
+	struct NodeQueue { mutex lock; deque<Job*> jobs; atomic<int> size{ 0 }; };
+	Job* GetNextJob( unsigned int threadId );
+	Job* TakeFrom( NodeQueue& queue );
+	void Work( unsigned int threadId );
+	bool Wait( unsigned int threadId, const uint64_t generation );
+	void Trace( const int thread, const int type, const int arg = 0 )
+	{
+		if (m_Tracing.load( memory_order_acquire )) m_Trace->Record( thread, type, arg );
+	}
+	static JobManager* m_JobManager;
+	JobThread* m_JobThreadList; // entry 0 is the thread that calls RunJobs
+	unsigned int m_NumThreads, m_NumNodes = 1;
+	// jobs added outside a job (m_Inject, or the queue of their node), and
+	// jobs for another node than that of the thread that added them
+	NodeQueue* m_NodeQueue = 0;
+	NodeQueue m_Inject;
+	atomic<int> m_Pending{ 0 }; // added and not yet completed
+	// waking threads for new jobs, and the caller of RunJobs once all jobs
+	// completed. m_Generation changes with every RunJobs and every job that
+	// a job adds; a worker waits for that, spinning, then parked on m_Go.
+	// The caller of RunJobs parks on m_Done.
+	mutex m_Lock;
+	condition_variable m_Go, m_Done;
+	atomic<uint64_t> m_Generation{ 0 };
+	atomic<int> m_Sleepers{ 0 };
+	atomic<bool> m_Joining{ false }, m_Stop{ false };
+	// spin tuning: average of the gaps between batches that are short enough
+	// to spin through, and the fraction of such gaps
+	bool m_CanSpin = false; // not with more threads than processors
+	atomic<int64_t> m_SpinNs{ 0 }, m_BatchStart{ 0 };
+	int64_t m_BatchEnd = 0;
+	float m_GapNs = 0, m_ShortGaps = 0;
+	// dispatch statistics: per worker and batch, the time from RunJobs to waking up
+	atomic<int64_t> m_WakeNs{ 0 }, m_Wakes{ 0 }, m_Parks{ 0 }, m_Batches{ 0 };
+	int64_t m_Reported[4] = {};
+	// created by the first StartTrace and kept, as workers may still record
+	// after StopTrace; freed by the destructor, once the workers are joined
+	JobTrace* m_Trace = 0;
+	atomic<bool> m_Tracing{ false };
+	inline static thread_local int m_ThreadIdx = -1; // -1: not running jobs
+};
+
+// ParallelFor( begin, end, grain, body ) calls body( i ) for every i in
+// [begin,end), or body( first, last ) for consecutive ranges of it, on all
+// threads, and returns when everything ran; the calling thread helps.
+// Threads claim chunks of 'grain' indices from a shared counter, so uneven
+// work balances out. Grain 0 picks about eight chunks per thread.
+// Nothing is allocated: a single job on the stack is queued once for every
+// thread that can help. A range of one chunk, and a call from inside a job,
+// runs on the calling thread. Call it from the main thread or from jobs.
+template <class F> class ForJob : public Job
+{
+public:
+	ForJob( const int first, const int last, const int chunk, F& f ) : next( first ), end( last ), grain( chunk ), body( f ) {}
+	void Main()
+	{
+		for (int first; (first = next.fetch_add( grain, memory_order_relaxed )) < end;)
+		{
+			const int last = first < end - grain ? first + grain : end;
+			if constexpr (is_invocable_v<F&, int, int>) body( first, last );
+			else for (int i = first; i < last; i++) body( i );
+		}
+	}
+private:
+	atomic<int> next;
+	const int end, grain;
+	F& body;
+};
+
+template <class F> void ParallelFor( const int begin, const int end, int grain, F&& body )
+{
+	if (end <= begin) return;
+	JobManager* jm = JobManager::GetJobManager();
+	const int threads = jm->GetNumThreads();
+	if (grain <= 0) grain = (int)max( 1ll, ((long long)end - begin + threads * 8 - 1) / (threads * 8) );
+	ForJob<F> job( begin, end, grain, body );
+	const long long chunks = ((long long)end - begin + grain - 1) / grain;
+	if (chunks == 1 || threads == 1 || JobManager::InJob()) { job.Main(); return; }
+	for (int i = (int)min( chunks, (long long)threads ); i > 0; i--) jm->AddJob2( &job );
+	jm->RunJobs();
+}
+
+// ParallelReduce( begin, end, grain, identity, body, combine ) folds the
+// results of body( i ), or of body( first, last ) for a range, with combine,
+// starting from identity. Chunks finish in any order, so combine must be
+// associative and commutative; float sums may differ in the last bits
+// between runs.
+template <class T, class F, class C> T ParallelReduce( const int begin, const int end, const int grain, const T identity, F&& body, C&& combine )
+{
+	T result = identity;
+	mutex lock;
+	ParallelFor( begin, end, grain, [&]( const int first, const int last )
+	{
+		T partial = identity;
+		if constexpr (is_invocable_v<F&, int, int>) partial = body( first, last );
+		else for (int i = first; i < last; i++) partial = combine( partial, body( i ) );
+		lock_guard<mutex> l( lock );
+		result = combine( result, partial );
+	} );
+	return result;
+}
+
+// TaskGraph: jobs with dependencies. Build the graph once with Add and
+// Precede, then Run it as often as needed; Run returns when all tasks
+// completed. A task is queued the moment its last predecessor completes,
+// by the thread that completed it, so independent chains never wait for
+// each other and there is no barrier between phases. Tasks run on the
+// workers; like RunJobs, Run must not be called from a job. A task with a
+// node runs on that NUMA node if possible, like a job passed to AddJob2.
+class TaskGraph
+{
+public:
+	int Add( function<void()> work, const int node = -1 ); // returns the id of the new task
+	void Precede( const int before, const int after ); // 'after' waits for 'before'
+	void Run();
+	int Size() { return (int)tasks.size(); }
+private:
+	class Task : public Job
+	{
+	public:
+		void Main();
+		TaskGraph* graph;
+		function<void()> work;
+		vector<Task*> successors;
+		int node;
+		int inputs = 0; // number of predecessors
+		atomic<int> waiting{ 0 }; // predecessors that did not complete yet
+	};
+	deque<Task> tasks; // a deque, so tasks never move
+	atomic<int> completed{ 0 };
+};
@@ -0,0 +1,128 @@
+// Template, IGAD version 3
+// Get the latest version from: https://github.com/jbikker/tmpl8
+// IGAD/NHTV/UU - Jacco Bikker - 2006-2023
+
+#include "precomp.h"
+
+// JobTrace implementation
+// ----------------------------------------------------------------------------
+
+JobTrace::JobTrace( const int n ) : threads( n ), ring( new Ring[n] )
+{
+	for (int i = 0; i < threads; i++) ring[i].event = new Event[CAPACITY];
+}
+
+JobTrace::~JobTrace()
+{
+	for (int i = 0; i < threads; i++) delete[] ring[i].event;
+	delete[] ring;
+}
+
+int64_t JobTrace::Now()
+{
+	return chrono::duration_cast<chrono::nanoseconds>( chrono::high_resolution_clock::now().time_since_epoch() ).count();
+}
+
+void JobTrace::Record( const int thread, const int type, const int arg )
+{
+	Ring& r = ring[thread];
+	const uint64_t head = r.head.load( memory_order_relaxed );
+	if (head - r.tail.load( memory_order_acquire ) == CAPACITY) { r.dropped.fetch_add( 1, memory_order_relaxed ); return; }
+	r.event[head % CAPACITY] = { Now(), type, arg };
+	r.head.store( head + 1, memory_order_release ); // publishes the event
+}
+
+void JobTrace::Restart()
+{
+	for (int i = 0; i < threads; i++)
+	{
+		Ring& r = ring[i];
+		r.tail.store( r.head.load( memory_order_acquire ), memory_order_release ); // stale events
+		r.dropped = 0, r.events.clear(), r.busy = r.jobs = r.steals = 0;
+	}
+	start = batchStart = Now();
+	batches = batchTime = 0, imbalanceSum = imbalanceMax = 0;
+}
+
+void JobTrace::Collect()
+{
+	int64_t busiest = 0, busy = 0, batchEnd = 0;
+	for (int i = 0; i < threads; i++)
+	{
+		Ring& r = ring[i];
+		const uint64_t head = r.head.load( memory_order_acquire );
+		uint64_t tail = r.tail.load( memory_order_relaxed );
+		int64_t threadBusy = 0, jobStart = -1;
+		for (; tail < head; tail++)
+		{
+			const Event& e = r.event[tail % CAPACITY];
+			if (e.type == JOB_BEGIN) jobStart = e.time;
+			else if (e.type == JOB_END && jobStart >= 0) threadBusy += e.time - jobStart, r.jobs++, jobStart = -1;
+			else if (e.type == STEAL) r.steals++;
+			else if (e.type == BATCH_BEGIN) batchStart = e.time;
+			else if (e.type == BATCH_END) batchEnd = e.time;
+			r.events.push_back( e );
+		}
+		r.tail.store( tail, memory_order_release ); // the slots may be reused
+		r.busy += threadBusy, busy += threadBusy, busiest = max( busiest, threadBusy );
+	}
+	if (batchEnd == 0 || busy == 0) return; // not the end of a batch, or nothing ran
+	const float imbalance = busiest * threads / (float)busy;
+	batches++, batchTime += batchEnd - batchStart;
+	imbalanceSum += imbalance, imbalanceMax = max( imbalanceMax, imbalance );
+}
+
+bool JobTrace::Write( const char* path )
+{
+	FILE* f = fopen( path, "w" );
+	if (!f) return false;
+	fprintf( f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n" );
+	for (int i = 0; i < threads; i++)
+	{
+		fprintf( f, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%i,\"args\":{\"name\":\"%s %i\"}},\n", i, i ? "worker" : "main", i );
+		const char* idle = 0; // open spin or park span
+		double ts = 0;
+		for (const Event& e : ring[i].events)
+		{
+			ts = (e.time - start) * 1e-3;
+			auto Span = [&]( const char* ph, const char* name )
+			{
+				fprintf( f, "{\"name\":\"%s\",\"ph\":\"%s\",\"pid\":1,\"tid\":%i,\"ts\":%.3f},\n", name, ph, i, ts );
+			};
+			switch (e.type)
+			{
+			case JOB_BEGIN: Span( "B", "job" ); break;
+			case JOB_END: Span( "E", "job" ); break;
+			case BATCH_BEGIN: Span( "B", "RunJobs" ); break;
+			case BATCH_END: Span( "E", "RunJobs" ); break;
+			case STEAL:
+				fprintf( f, "{\"name\":\"steal\",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":%i,\"ts\":%.3f,\"args\":{\"victim\":%i}},\n", i, ts, e.arg );
+				break;
+			case SPIN: Span( "B", idle = "spin" ); break;
+			case PARK:
+				if (idle) Span( "E", idle );
+				Span( "B", idle = "parked" );
+				break;
+			case WAKE:
+				if (idle) Span( "E", idle );
+				idle = 0;
+				break;
+			}
+		}
+		if (idle) fprintf( f, "{\"name\":\"%s\",\"ph\":\"E\",\"pid\":1,\"tid\":%i,\"ts\":%.3f},\n", idle, i, ts ); // still idle
+	}
+	fprintf( f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"job system\"}}]}\n" ); // last: no comma
+	fclose( f );
+	return true;
+}
+
+char* JobTrace::Summary( char* t )
+{
+	int64_t jobs = 0, busy = 0, dropped = 0;
+	for (int i = 0; i < threads; i++) jobs += ring[i].jobs, busy += ring[i].busy, dropped += ring[i].dropped;
+	t += sprintf( t, "trace: %i batches, %i jobs, %.2f us per job, imbalance %.2f (worst %.2f), %i events dropped\n",
+		(int)batches, (int)jobs, jobs ? busy * 1e-3f / jobs : 0, batches ? imbalanceSum / batches : 0, imbalanceMax, (int)dropped );
+	for (int i = 0; i < threads; i++) t += sprintf( t, "thread %2i: %5.1f%% busy in batches, %7i jobs, %6i steals\n", i,
+		batchTime ? ring[i].busy * 100.0f / batchTime : 0, (int)ring[i].jobs, (int)ring[i].steals );
+	return t;
+}
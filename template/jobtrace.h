@@ -0,0 +1,44 @@
+// Template, IGAD version 3
+// Get the latest version from: https://github.com/jbikker/tmpl8
+// IGAD/NHTV/UU - Jacco Bikker - 2006-2023
+
+#pragma once
+
+// Timeline of the job system. Every thread records its job begin and end,
+// steals, spinning, parking and waking into a ring buffer of its own, which
+// takes no locks: the thread is the only writer, the thread that calls
+// RunJobs the only reader. That thread collects the events after every
+// batch and keeps metrics per batch; Write exports the recording as a
+// Chrome trace, for chrome://tracing or ui.perfetto.dev.
+class JobTrace
+{
+public:
+	enum { JOB_BEGIN = 0, JOB_END, STEAL, SPIN, PARK, WAKE, BATCH_BEGIN, BATCH_END };
+	enum { CAPACITY = 1 << 16 }; // events per thread between two collections; more are dropped
+	struct Event { int64_t time; int type, arg; };
+	JobTrace( const int threads );
+	~JobTrace();
+	static int64_t Now(); // nanoseconds
+	void Record( const int thread, const int type, const int arg = 0 ); // by 'thread' only
+	void Restart(); // forgets all events and metrics
+	void Collect(); // takes the new events from the rings, and updates the metrics
+	bool Write( const char* path );
+	char* Summary( char* t ); // appends the metrics, returns the end
+private:
+	struct Ring
+	{
+		alignas( 64 ) atomic<uint64_t> head{ 0 }; // written by the recording thread
+		alignas( 64 ) atomic<uint64_t> tail{ 0 }; // written by the collecting thread
+		atomic<int64_t> dropped{ 0 };
+		Event* event;
+		vector<Event> events; // collected
+		int64_t busy = 0, jobs = 0, steals = 0; // metrics
+	};
+	int threads;
+	Ring* ring;
+	int64_t start = 0, batchStart = 0;
+	// per-batch metrics: time in batches, load imbalance (busiest thread
+	// over the average thread)
+	int64_t batches = 0, batchTime = 0;
+	float imbalanceSum = 0, imbalanceMax = 0;
+};
@@ -3,17 +3,14 @@
 // IGAD/NHTV/UU - Jacco Bikker - 2006-2023
 
 #include "precomp.h"
+#include <filesystem>
 
 using namespace std;
 
-// source file information
-static int sourceFiles = 0;
-static char* sourceFile[64]; // yup, ugly constant
-
-// access to GLFW window in template.cpp
-extern GLFWwindow* window;
-
-#define CHECKCL(r) CheckCL( r, __FILE__, __LINE__ )
+// compiled programs are cached in this folder, keyed by a hash of the
+// expanded source, the build options, the device and its driver. Comment
+// out to compile from source every time.
+#define PROGRAM_CACHE "clcache"
 
 void FatalError( const char* fmt, ... )
 {
@@ -30,6 +27,185 @@ void FatalError( const char* fmt, ... )
 	while (1) exit( 0 );
 }
 
+// program cache helpers
+// ----------------------------------------------------------------------------
+static uint64_t Hash( uint64_t h, const void* data, const size_t size ) // FNV-1a
+{
+	for (size_t i = 0; i < size; i++) h = (h ^ ((const uchar*)data)[i]) * 0x100000001b3ull;
+	return h;
+}
+static uint64_t Hash( const uint64_t h, const string& s ) { return Hash( h, s.data(), s.size() ); }
+
+static int64_t ModifiedTime( const string& file )
+{
+	error_code ec;
+	const filesystem::file_time_type time = filesystem::last_write_time( file, ec );
+	return ec ? 0 : (int64_t)time.time_since_epoch().count();
+}
+
+// cache entries are named <file>.<key>.bin, with the path separators in the
+// file name replaced, and the key as 16 hexadecimal digits. Files whose names
+// only differ in separators and underscores remove each other's entries.
+static string CacheFile( const string& file, const uint64_t key )
+{
+	string name = file;
+	for (char& c : name) if (c == '/' || c == '\\' || c == ':') c = '_';
+	char hex[24];
+	snprintf( hex, sizeof( hex ), ".%016llx.bin", (unsigned long long)key );
+	return string( PROGRAM_CACHE "/" ) + name + hex;
+}
+
+// true if 'entry' is the name of a cache entry for 'file', for any key
+static bool IsCacheFile( const string& entry, const string& file )
+{
+	const string name = CacheFile( file, 0 );
+	if (entry.size() != name.size() || entry.compare( 0, name.size() - 20, name, 0, name.size() - 20 ) != 0) return false;
+	for (size_t i = name.size() - 20; i < name.size() - 4; i++) if (!isxdigit( (uchar)entry[i] )) return false;
+	return entry.compare( name.size() - 4, 4, ".bin" ) == 0;
+}
+
+// #include expansion
+// The program is passed to the compiler as one text, with all #include "file"
+// directives expanded recursively: the cache key then covers every file, and
+// the list of files tells when a kernel must be rebuilt. Files are searched
+// next to the file that includes them, then in the working directory. A file
+// with #pragma once or an include guard around all of its text is expanded
+// only once, assuming the guard is never #undef'd. #line directives make the
+// compiler report the original files and lines; 'map' does the same for
+// compilers that ignore those.
+// ----------------------------------------------------------------------------
+struct SourceLine { int file, line; }; // file -1: vendor defines
+struct Sources
+{
+	vector<string> files;	// files[0] is the kernel file
+	vector<bool> once;		// not to be expanded again
+	vector<int> stack;		// files being expanded
+	vector<SourceLine> map;	// for every line of text, from 0
+	string text;
+};
+
+// the argument of a preprocessor directive in 'line', if it is 'name'
+static bool Directive( const string& line, const char* name, string& argument )
+{
+	size_t pos = line.find_first_not_of( " \t" );
+	if (pos == string::npos || line[pos] != '#') return false;
+	pos = line.find_first_not_of( " \t", pos + 1 );
+	const size_t length = strlen( name );
+	if (pos == string::npos || line.compare( pos, length, name ) != 0) return false;
+	pos += length;
+	if (pos < line.size() && line[pos] != ' ' && line[pos] != '\t' && line[pos] != '"' && line[pos] != '\r') return false;
+	const size_t first = line.find_first_not_of( " \t", pos ), last = line.find_last_not_of( " \t\r" );
+	argument = first == string::npos || last < first ? "" : line.substr( first, last - first + 1 );
+	return true;
+}
+
+// #ifndef X, #define X, ..., #endif; lines with just // comments aside
+static bool HasGuard( const string& text )
+{
+	vector<string> lines;
+	for (size_t pos = 0, end; pos < text.size(); pos = end + 1)
+	{
+		end = min( text.find( '\n', pos ), text.size() );
+		const size_t first = text.find_first_not_of( " \t\r", pos );
+		if (first < end && text.compare( first, 2, "//" ) != 0) lines.push_back( text.substr( first, end - first ) );
+	}
+	string guard, defined, ignored;
+	return lines.size() >= 3 && Directive( lines[0], "ifndef", guard ) && Directive( lines[1], "define", defined ) &&
+		Directive( lines.back(), "endif", ignored ) && guard != "" && defined == guard;
+}
+
+static void Expand( Sources& s, const int idx )
+{
+	if (s.stack.size() > 32) FatalError( "#include nesting too deep in %s", s.files[idx].c_str() );
+	s.stack.push_back( idx );
+	string text = TextFileRead( s.files[idx].c_str() );
+	if (text.compare( 0, 3, "\xef\xbb\xbf" ) == 0) text.erase( 0, 3 ); // UTF-8 byte order mark
+	if (HasGuard( text )) s.once[idx] = true;
+	auto Emit = [&]( const string& line, const int nr ) { s.text += line + "\n", s.map.push_back( { idx, nr } ); };
+	Emit( "#line 1 \"" + s.files[idx] + "\"", 0 );
+	int lineNr = 0;
+	for (size_t pos = 0, end; pos < text.size(); pos = end + 1, lineNr++)
+	{
+		end = min( text.find( '\n', pos ), text.size() );
+		const string line = text.substr( pos, end - pos );
+		string argument;
+		size_t close;
+		if (Directive( line, "pragma", argument ) && argument == "once") { s.once[idx] = true; Emit( "", lineNr ); continue; }
+		if (!Directive( line, "include", argument ) || argument[0] != '"' || (close = argument.find( '"', 1 )) == string::npos)
+		{
+			Emit( line, lineNr );
+			continue;
+		}
+		const string name = argument.substr( 1, close - 1 );
+		filesystem::path path = filesystem::path( s.files[idx] ).parent_path() / name;
+		if (!FileExists( path.string().c_str() )) path = name;
+		if (!FileExists( path.string().c_str() ))
+		{
+			// left to the compiler; it may be in code that is not compiled
+			Emit( line, lineNr );
+			continue;
+		}
+		const string file = path.lexically_normal().generic_string();
+		const int inc = (int)(find( s.files.begin(), s.files.end(), file ) - s.files.begin());
+		if (inc == (int)s.files.size()) s.files.push_back( file ), s.once.push_back( false );
+		if (s.once[inc] || find( s.stack.begin(), s.stack.end(), inc ) != s.stack.end())
+		{
+			Emit( "", lineNr ); // already expanded, or a cycle
+			continue;
+		}
+		Expand( s, inc );
+		Emit( "#line " + to_string( lineNr + 2 ) + " \"" + s.files[idx] + "\"", lineNr );
+	}
+	s.stack.pop_back();
+}
+
+// self-check of the above, for RunBenchmarks: cache entry names, the FNV-1a
+// key, and #include expansion of a few files in the temporary folder
+void CheckKernelSources()
+{
+	const string entry = CacheFile( "kernels/a.cl", 0x0123456789abcdefull );
+	if (entry != PROGRAM_CACHE "/kernels_a.cl.0123456789abcdef.bin") FatalError( "CacheFile: %s", entry.c_str() );
+	if (!IsCacheFile( entry, "kernels/a.cl" ) || !IsCacheFile( CacheFile( "kernels/a.cl", 0 ), "kernels/a.cl" ) ||
+		IsCacheFile( CacheFile( "kernels/a.cl.cl", 1 ), "kernels/a.cl" ) || IsCacheFile( CacheFile( "kernels/a.cl", 1 ), "kernels/a.cl.cl" ) ||
+		IsCacheFile( PROGRAM_CACHE "/kernels_a.cl.0123456789abcdeg.bin", "kernels/a.cl" ) ||
+		IsCacheFile( PROGRAM_CACHE "/kernels_a.cl.0123456789abcdef.bim", "kernels/a.cl" ))
+		FatalError( "IsCacheFile matches the wrong entries." );
+	if (Hash( 14695981039346656037ull, string( "a" ) ) != 0xaf63dc4c8601ec8cull) FatalError( "Hash is not FNV-1a." );
+	// k.cl includes a.h twice (#pragma once), b.h (include guard) via a.h and
+	// directly, c.h, which includes k.cl again (a cycle), and a missing file
+	error_code ec;
+	const filesystem::path folder = filesystem::temp_directory_path( ec ) / "tmpl8_expand";
+	filesystem::create_directories( folder, ec );
+	const string dir = folder.lexically_normal().generic_string() + "/";
+	auto Write = [&]( const char* file, const char* text ) { ofstream( dir + file, ios::binary ) << text; };
+	Write( "k.cl", "#include \"a.h\"\n#include \"a.h\"\n#include \"b.h\"\n#include \"c.h\"\n#include \"none.h\"\nkernel\n" );
+	Write( "a.h", "#pragma once\n#include \"b.h\"\na\n" );
+	Write( "b.h", "// b\n#ifndef B\n#define B\nb\n#endif\n" );
+	Write( "c.h", "#include \"k.cl\"\nc\n" );
+	Sources s;
+	s.files.push_back( filesystem::path( dir + "k.cl" ).lexically_normal().generic_string() ), s.once.push_back( false );
+	Expand( s, 0 );
+	const string k = "#line 1 \"" + dir + "k.cl\"\n", a = "#line 1 \"" + dir + "a.h\"\n";
+	const string b = "#line 1 \"" + dir + "b.h\"\n", c = "#line 1 \"" + dir + "c.h\"\n";
+	auto Back = [&]( const char* file, const int line ) { return "#line " + to_string( line ) + " \"" + dir + file + "\"\n"; };
+	const string expected = k + a + "\n" + b + "// b\n#ifndef B\n#define B\nb\n#endif\n" + Back( "a.h", 3 ) + "a\n" + Back( "k.cl", 2 ) +
+		"\n\n" + c + "\n" + "c\n" + Back( "k.cl", 5 ) + "#include \"none.h\"\nkernel\n";
+	filesystem::remove_all( folder, ec );
+	if (s.text != expected) FatalError( "#include expansion:\n%s\nexpected:\n%s", s.text.c_str(), expected.c_str() );
+	int lines = 0;
+	for (char ch : s.text) lines += ch == '\n';
+	if (s.files.size() != 4 || (int)s.map.size() != lines || s.map[2].file != 1 || s.map[4].file != 2 || s.map[5].line != 1)
+		FatalError( "#include expansion: wrong files or line map." );
+}
+
+// no OpenCL in headless builds
+#ifndef HEADLESS
+
+// access to GLFW window in template.cpp
+extern GLFWwindow* window;
+
+#define CHECKCL(r) CheckCL( r, __FILE__, __LINE__ )
+
 // CHECKCL method
 // OpenCL error handling.
 // ----------------------------------------------------------------------------
@@ -143,6 +319,29 @@ static cl_int getPlatformID( cl_platform_id* platform )
 	return CL_SUCCESS;
 }
 
+static string GetDeviceString( cl_device_id device, cl_device_info param )
+{
+	size_t size = 0;
+	clGetDeviceInfo( device, param, 0, NULL, &size );
+	string value( size, 0 );
+	clGetDeviceInfo( device, param, size, value.data(), NULL );
+	return value;
+}
+
+// zero-copy host memory: page-aligned and whole pages, which Intel's runtimes
+// need to use it in place. The pages are freed when the runtime destroys the
+// buffer, after the last command that uses them.
+static void* MallocPages( const size_t size )
+{
+	const size_t bytes = max( (size_t)4096, (size + 4095) & ~(size_t)4095 );
+#ifdef _MSC_VER
+	return _aligned_malloc( bytes, 4096 );
+#else
+	return aligned_alloc( 4096, bytes );
+#endif
+}
+static void CL_CALLBACK FreePages( cl_mem, void* pages ) { FREE64( pages ); }
+
 // Buffer constructor
 // ----------------------------------------------------------------------------
 Buffer::Buffer( unsigned int N, void* ptr, unsigned int t )
@@ -158,8 +357,17 @@ Buffer::Buffer( unsigned int N, void* ptr, unsigned int t )
 	{
 		size = N;
 		textureID = 0; // not representing a texture
-		deviceBuffer = clCreateBuffer( Kernel::GetContext(), rwFlags, size, 0, 0 );
 		hostBuffer = (uint*)ptr;
+		zeroCopy = (t & ZEROCOPY) != 0;
+		if (zeroCopy)
+		{
+			if (!hostBuffer) hostBuffer = (uint*)MallocPages( size ), ownData = aligned = true;
+			cl_int error;
+			deviceBuffer = clCreateBuffer( Kernel::GetContext(), rwFlags | CL_MEM_USE_HOST_PTR, size, hostBuffer, &error );
+			CHECKCL( error );
+			Map( Kernel::GetQueue(), true, "CopyFromDevice" ); // the host has it
+		}
+		else deviceBuffer = clCreateBuffer( Kernel::GetContext(), rwFlags, size, 0, 0 );
 	}
 	else
 	{
@@ -177,34 +385,48 @@ Buffer::Buffer( unsigned int N, void* ptr, unsigned int t )
 // ----------------------------------------------------------------------------
 Buffer::~Buffer()
 {
+	if ((type & (TEXTURE | TARGET)) == 0)
+	{
+		if (mapped) Unmap( Kernel::GetQueue(), false, 0, size, "CopyToDevice" );
+		// the host memory of a zero-copy buffer is in use until it is handed over
+		if (handOver) clWaitForEvents( 1, &handOver ), clReleaseEvent( handOver );
+		if (zeroCopy && ownData) clSetMemObjectDestructorCallback( deviceBuffer, FreePages, hostBuffer ), ownData = false;
+		clReleaseMemObject( deviceBuffer );
+	}
 	if (ownData)
 	{
 		FREE64( hostBuffer );
 		hostBuffer = 0;
 	}
-	if ((type & (TEXTURE | TARGET)) == 0) clReleaseMemObject( deviceBuffer );
 }
 
 // CopyToDevice method
 // ----------------------------------------------------------------------------
 void Buffer::CopyToDevice( bool blocking )
 {
+	if (zeroCopy) { Unmap( Kernel::GetQueue(), blocking, 0, size, "CopyToDevice" ); return; }
 	cl_int error;
-	CHECKCL( error = clEnqueueWriteBuffer( Kernel::GetQueue(), deviceBuffer, blocking, 0, size, hostBuffer, 0, 0, 0 ) );
+	cl_event* e = Kernel::ProfileEvent( 0 );
+	CHECKCL( error = clEnqueueWriteBuffer( Kernel::GetQueue(), deviceBuffer, blocking, 0, size, hostBuffer, 0, 0, e ) );
+	Kernel::Profile( "CopyToDevice", e, 0, true );
 }
 
 // CopyToDevice2 method (uses 2nd queue)
 // ----------------------------------------------------------------------------
 void Buffer::CopyToDevice2( bool blocking, cl_event* eventToSet, const size_t s )
 {
+	if (zeroCopy) { Unmap( Kernel::GetQueue2(), blocking, eventToSet, s == 0 ? size : s, "CopyToDevice2" ); return; }
 	cl_int error;
-	CHECKCL( error = clEnqueueWriteBuffer( Kernel::GetQueue2(), deviceBuffer, blocking ? CL_TRUE : CL_FALSE, 0, s == 0 ? size : s, hostBuffer, 0, 0, eventToSet ) );
+	cl_event* e = Kernel::ProfileEvent( eventToSet );
+	CHECKCL( error = clEnqueueWriteBuffer( Kernel::GetQueue2(), deviceBuffer, blocking ? CL_TRUE : CL_FALSE, 0, s == 0 ? size : s, hostBuffer, 0, 0, e ) );
+	Kernel::Profile( "CopyToDevice2", e, eventToSet, true );
 }
 
 // CopyFromDevice method
 // ----------------------------------------------------------------------------
 void Buffer::CopyFromDevice( bool blocking )
 {
+	if (zeroCopy) { Map( Kernel::GetQueue(), blocking, "CopyFromDevice" ); return; }
 	cl_int error;
 	if (!hostBuffer)
 	{
@@ -212,14 +434,20 @@ void Buffer::CopyFromDevice( bool blocking )
 		ownData = true;
 		aligned = true;
 	}
-	CHECKCL( error = clEnqueueReadBuffer( Kernel::GetQueue(), deviceBuffer, blocking, 0, size, hostBuffer, 0, 0, 0 ) );
+	cl_event* e = Kernel::ProfileEvent( 0 );
+	CHECKCL( error = clEnqueueReadBuffer( Kernel::GetQueue(), deviceBuffer, blocking, 0, size, hostBuffer, 0, 0, e ) );
+	Kernel::Profile( "CopyFromDevice", e, 0, true );
 }
 
 // CopyTo
 // ----------------------------------------------------------------------------
 void Buffer::CopyTo( Buffer* buffer )
 {
-	clEnqueueCopyBuffer( Kernel::GetQueue(), deviceBuffer, buffer->deviceBuffer, 0, 0, size, 0, 0, 0 );
+	if (mapped) Unmap( Kernel::GetQueue(), false, 0, size, "CopyToDevice" );
+	if (buffer->mapped) buffer->Unmap( Kernel::GetQueue(), false, 0, buffer->size, "CopyToDevice" );
+	cl_event* e = Kernel::ProfileEvent( 0 );
+	clEnqueueCopyBuffer( Kernel::GetQueue(), deviceBuffer, buffer->deviceBuffer, 0, 0, size, 0, 0, e );
+	Kernel::Profile( "CopyTo", e, 0, true );
 }
 
 // Clear
@@ -232,18 +460,58 @@ void Buffer::Clear()
 	CopyToDevice();
 #else
 	cl_int error;
+	if (mapped) Unmap( Kernel::GetQueue(), false, 0, size, "CopyToDevice" );
 	CHECKCL( error = clEnqueueFillBuffer( Kernel::GetQueue(), deviceBuffer, &value, 4, 0, size, 0, 0, 0 ) );
 #endif
 }
 
+// Map / Unmap
+// Zero-copy buffers change hands instead of being copied. Host writes made
+// while the device had the buffer are handed over by mapping it again first,
+// without reading it back (CL_MAP_WRITE_INVALIDATE_REGION).
+// ----------------------------------------------------------------------------
+void Buffer::Map( cl_command_queue queue, const bool blocking, const char* name )
+{
+	if (mapped) return;
+	cl_int error;
+	if (handOver) clReleaseEvent( handOver );
+	clEnqueueMapBuffer( queue, deviceBuffer, blocking, CL_MAP_READ | CL_MAP_WRITE, 0, size, 0, 0, &handOver, &error );
+	CHECKCL( error );
+	Kernel::Profile( name, &handOver, &handOver, true );
+	mapped = true, mapQueue = queue; // at hostBuffer: memory of CL_MEM_USE_HOST_PTR buffers maps to itself
+}
+
+void Buffer::Unmap( cl_command_queue queue, const bool blocking, cl_event* eventToSet, const size_t bytes, const char* name )
+{
+	cl_int error;
+	void* ptr = hostBuffer;
+	if (mapped) queue = mapQueue; // in order with the map, which may not have completed yet
+	else
+	{
+		ptr = clEnqueueMapBuffer( queue, deviceBuffer, CL_FALSE, CL_MAP_WRITE_INVALIDATE_REGION, 0, bytes, 0, 0, 0, &error );
+		CHECKCL( error );
+	}
+	if (handOver) clReleaseEvent( handOver );
+	CHECKCL( error = clEnqueueUnmapMemObject( queue, deviceBuffer, ptr, 0, 0, &handOver ) );
+	Kernel::Profile( name, &handOver, &handOver, true );
+	if (eventToSet) *eventToSet = handOver, clRetainEvent( handOver ); // the caller releases it
+	if (blocking) clWaitForEvents( 1, &handOver );
+	mapped = false;
+}
+
 // Kernel constructor
 // ----------------------------------------------------------------------------
 Kernel::Kernel( char* file, char* entryPoint )
 {
 	if (!clStarted) InitCL();
-	// load a cl file
-	string csText = TextFileRead( file );
-	if (csText.size() == 0) FatalError( "File %s not found", file );
+	name = entryPoint;
+	// load a cl file, with its includes
+	if (!FileExists( file )) FatalError( "File %s not found", file );
+	Sources sources;
+	sources.files.push_back( filesystem::path( file ).lexically_normal().generic_string() );
+	sources.once.push_back( false );
+	Expand( sources, 0 );
+	string csText = sources.text;
 	// add vendor defines
 	vendorLines = 0;
 	if (isNVidia) csText = "#define ISNVIDIA\n" + csText, vendorLines++;
@@ -253,79 +521,89 @@ Kernel::Kernel( char* file, char* entryPoint )
 	if (isAmpere) csText = "#define ISAMPERE\n" + csText, vendorLines++;
 	if (isTuring) csText = "#define ISTURING\n" + csText, vendorLines++;
 	if (isPascal) csText = "#define ISPASCAL\n" + csText, vendorLines++;
-	// expand #include directives: cl compiler doesn't support these natively
-	// warning: this simple system does not handle nested includes.
-	struct Include { int start, end; string file; } includes[64];
-	int Ninc = 0;
-#if 0 // needed for NVIDIA OpenCL 1.0; this no longer is necessary
-	while (1)
-	{
-		// see if any #includes remain
-		size_t pos = csText.find( "#include" );
-		if (pos == string::npos) break;
-		// start of expanded source construction
-		string tmp;
-		if (pos > 0)
-			tmp = csText.substr( 0, pos - 1 ) + "\n",
-			includes[Ninc].start = LineCount( tmp ); // record first line of #include content
-		else
-			includes[Ninc].start = 0;
-		// parse filename of include file
-		pos = csText.find( "\"", pos + 1 );
-		if (pos == string::npos) FatalError( "Expected \" after #include in shader." );
-		size_t end = csText.find( "\"", pos + 1 );
-		if (end == string::npos) FatalError( "Expected second \" after #include in shader." );
-		string file = csText.substr( pos + 1, end - pos - 1 );
-		// load include file content
-		string incText = TextFileRead( file.c_str() );
-		includes[Ninc].end = includes[Ninc].start + LineCount( incText );
-		includes[Ninc++].file = file;
-		if (incText.size() == 0) FatalError( "#include file not found:\n%s", file.c_str() );
-		// cleanup include file content: we get some crap first sometimes, but why?
-		int firstValidChar = 0;
-		while (incText[firstValidChar] < 0) firstValidChar++;
-		// add include file content and remainder of source to expanded source string
-		tmp += incText.substr( firstValidChar, string::npos );
-		tmp += csText.substr( end + 1, string::npos ) + "\n";
-		// repeat until no #includes left
-		csText = tmp;
+	sources.map.insert( sources.map.begin(), vendorLines, SourceLine{ -1, 0 } );
+	// remember the files, to see when they change
+	dependencies = sources.files, dependencyTimes.clear();
+	for (const string& f : dependencies) dependencyTimes.push_back( ModifiedTime( f ) );
+	const char* options = "-cl-fast-relaxed-math -cl-mad-enable -cl-single-precision-constant";
+	cl_int error;
+	size_t size;
+#ifdef PROGRAM_CACHE
+	// a binary of the same source, options, device and driver skips the compiler.
+	// Entries are named after the source file, so an entry for an older version
+	// of the file can be recognized and removed when a new one is stored.
+	uint64_t key = Hash( Hash( 14695981039346656037ull, csText ), options );
+	for (cl_device_info info : { CL_DEVICE_NAME, CL_DEVICE_VENDOR, CL_DEVICE_VERSION, CL_DRIVER_VERSION })
+		key = Hash( key, GetDeviceString( device, info ) );
+	const string cacheFile = CacheFile( file, key );
+	program = 0;
+	if (FILE* f = fopen( cacheFile.c_str(), "rb" ))
+	{
+		fseek( f, 0, SEEK_END );
+		const long length = ftell( f );
+		vector<uchar> binary( max( 0l, length ) );
+		fseek( f, 0, SEEK_SET );
+		size = fread( binary.data(), 1, binary.size(), f );
+		fclose( f );
+		const uchar* data = binary.data();
+		cl_int status;
+		if (length > 0) program = clCreateProgramWithBinary( context, 1, &device, &size, &data, &status, &error );
+		if (!program || error != CL_SUCCESS || status != CL_SUCCESS || clBuildProgram( program, 0, NULL, options, NULL, NULL ) != CL_SUCCESS)
+		{
+			// unusable, e.g. empty or truncated: compile from source, which replaces it
+			if (program) clReleaseProgram( program );
+			program = 0;
+		}
+	}
+	if (program)
+	{
+		kernel = clCreateKernel( program, entryPoint, &error );
+		if (kernel == 0) FatalError( "clCreateKernel failed: entry point not found." );
+		CHECKCL( error );
+		return;
 	}
 #endif
 	// attempt to compile the loaded and expanded source text
 	const char* source = csText.c_str();
-	size_t size = strlen( source );
-	cl_int error;
+	size = strlen( source );
 	program = clCreateProgramWithSource( context, 1, (const char**)&source, &size, &error );
 	CHECKCL( error );
 	// why does the nvidia compiler not support these:
 	// -cl-nv-maxrregcount=64 not faster than leaving it out (same for 128)
 	// -cl-no-subgroup-ifp ? fails on nvidia.
-#if 1
 	// AMD compatible compilation, thanks Jasper the Winther
-	error = clBuildProgram( program, 0, NULL, "-cl-fast-relaxed-math -cl-mad-enable -cl-single-precision-constant", NULL, NULL );
-
-#else
-	error = clBuildProgram( program, 0, NULL, "-cl-nv-verbose -cl-fast-relaxed-math -cl-mad-enable -cl-single-precision-constant", NULL, NULL );
-#endif
+	error = clBuildProgram( program, 0, NULL, options, NULL, NULL );
 	// handle errors
 	if (error == CL_SUCCESS)
 	{
-		// dump PTX via: https://forums.developer.nvidia.com/t/pre-compiling-opencl-kernels-tutorial/17089
-		// and: https://stackoverflow.com/questions/12868889/clgetprograminfo-cl-program-binary-sizes-incorrect-results
+	#ifdef PROGRAM_CACHE
+		// store the binary (PTX on NVIDIA) for the next run, via a temporary
+		// file, so that a crash never leaves half an entry
+		// see: https://forums.developer.nvidia.com/t/pre-compiling-opencl-kernels-tutorial/17089
 		cl_uint devCount;
 		CHECKCL( clGetProgramInfo( program, CL_PROGRAM_NUM_DEVICES, sizeof( cl_uint ), &devCount, NULL ) );
-		size_t* sizes = new size_t[devCount];
-		sizes[0] = 0;
-		size_t received;
-		CHECKCL( clGetProgramInfo( program, CL_PROGRAM_BINARY_SIZES /* wrong data... */, devCount * sizeof( size_t ), sizes, &received ) );
-		char** binaries = new char* [devCount];
-		for (uint i = 0; i < devCount; i++)
-			binaries[i] = new char[sizes[i] + 1];
-		CHECKCL( clGetProgramInfo( program, CL_PROGRAM_BINARIES, devCount * sizeof( size_t ), binaries, NULL ) );
-		FILE* f = fopen( "buildlog.txt", "wb" );
-		for (uint i = 0; i < devCount; i++)
-			fwrite( binaries[i], 1, sizes[i] + 1, f );
-		fclose( f );
+		size_t binarySize = 0;
+		if (devCount == 1) CHECKCL( clGetProgramInfo( program, CL_PROGRAM_BINARY_SIZES, sizeof( size_t ), &binarySize, NULL ) );
+		if (binarySize > 0)
+		{
+			vector<uchar> binary( binarySize );
+			uchar* data = binary.data();
+			CHECKCL( clGetProgramInfo( program, CL_PROGRAM_BINARIES, sizeof( uchar* ), &data, NULL ) );
+			error_code ec;
+			filesystem::create_directories( PROGRAM_CACHE, ec );
+			const string temp = cacheFile + ".tmp";
+			FILE* f = fopen( temp.c_str(), "wb" );
+			bool written = f && fwrite( data, 1, binarySize, f ) == binarySize;
+			if (f && fclose( f ) != 0) written = false;
+			if (written) filesystem::rename( temp, cacheFile, ec ); else filesystem::remove( temp, ec );
+			// entries for older versions of this file are stale now
+			if (written && !ec) for (const auto& entry : filesystem::directory_iterator( PROGRAM_CACHE, ec ))
+			{
+				const string name = entry.path().generic_string();
+				if (IsCacheFile( name, file ) && name != cacheFile) filesystem::remove( entry.path(), ec );
+			}
+		}
+	#endif
 	}
 	else
 	{
@@ -337,57 +615,44 @@ Kernel::Kernel( char* file, char* entryPoint )
 		FILE* f = fopen( "errorlog.txt", "wb" );
 		fwrite( log, 1, size, f );
 		fclose( f );
-		// find and display the first error. Note: platform specific sadly; code below is for NVIDIA
+		// find and display the first error. Logs have "<file>:<line>:<pos>: error:",
+		// with the file named by #line, or something like "<kernel>" and a line
+		// of the expanded text, for compilers that ignore the file name.
 		char* errorString = strstr( log, ": error:" );
 		if (errorString)
 		{
-			int errorPos = (int)(errorString - log);
-			while (errorPos > 0) if (log[errorPos - 1] == '\n') break; else errorPos--;
-			// translate file and line number of error and report
-			log[errorPos + 2048] = 0;
-			int lineNr = 0, linePos = 0;
-			char* lns = strstr( log + errorPos, ">:" ), * eol;
-			if (!lns) FatalError( log + errorPos ); else
+			char* lineStart = errorString, * eol = errorString + 8;
+			while (lineStart > log && lineStart[-1] != '\n') lineStart--;
+			while (*eol != '\n' && *eol != '\r' && *eol) eol++;
+			*eol = 0;
+			// parse ":<line>:<pos>" backwards from ": error:"
+			int number[2] = { -1, -1 }; // pos, line
+			char* p = errorString;
+			for (int i = 0; i < 2; i++)
 			{
-				lns += 2;
-				while (*lns >= '0' && *lns <= '9') lineNr = lineNr * 10 + (*lns++ - '0');
-				lns++; // proceed to line number
-				while (*lns >= '0' && *lns <= '9') linePos = linePos * 10 + (*lns++ - '0');
-				lns += 9; // proceed to error message
-				eol = lns;
-				while (*eol != '\n' && *eol > 0) eol++;
-				*eol = 0;
-				lineNr--; // we count from 0 instead of 1
-				// adjust file and linenr based on include file data
-				string errorFile = file;
-				bool errorInInclude = false;
-				for (int i = Ninc - 1; i >= 0; i--)
-				{
-					if (lineNr > includes[i].end)
-					{
-						for (int j = 0; j <= i; j++) lineNr -= includes[j].end - includes[j].start;
-						break;
-					}
-					else if (lineNr > includes[i].start)
-					{
-						errorFile = includes[i].file;
-						lineNr -= includes[i].start;
-						errorInInclude = true;
-						break;
-					}
-				}
-				if (!errorInInclude) lineNr -= vendorLines;
-				// present error message
-				char t[1024];
-				sprintf( t, "file %s, line %i, pos %i:\n%s", errorFile.c_str(), lineNr + 1, linePos, lns );
-				FatalError( t, "Build error" );
+				char* digits = p;
+				while (p > lineStart && p[-1] >= '0' && p[-1] <= '9') p--;
+				if (p == digits || p == lineStart || p[-1] != ':') break;
+				number[i] = atoi( p ), p--;
+			}
+			if (number[1] < 0) FatalError( "%s", lineStart ); // unknown format
+			string errorFile( lineStart, p - lineStart );
+			int lineNr = number[1], linePos = number[0];
+			const bool known = find( sources.files.begin(), sources.files.end(), errorFile ) != sources.files.end();
+			if (!known && lineNr >= 1 && lineNr <= (int)sources.map.size())
+			{
+				const SourceLine& line = sources.map[lineNr - 1];
+				errorFile = line.file < 0 ? "vendor defines" : sources.files[line.file], lineNr = line.line + 1;
 			}
+			char* message = errorString + 8;
+			while (*message == ' ') message++;
+			FatalError( "file %s, line %i, pos %i:\n%s", errorFile.c_str(), lineNr, linePos, message );
 		}
 		else
 		{
 			// error string has unknown format; just dump it to a window
 			log[2048] = 0; // truncate very long logs
-			FatalError( log, "Build error" );
+			FatalError( "%s", log );
 		}
 	}
 	kernel = clCreateKernel( program, entryPoint, &error );
@@ -399,12 +664,22 @@ Kernel::Kernel( cl_program& existingProgram, char* entryPoint )
 {
 	CheckCLStarted();
 	cl_int error;
+	name = entryPoint;
 	program = existingProgram;
 	kernel = clCreateKernel( program, entryPoint, &error );
 	if (kernel == 0) FatalError( "clCreateKernel failed: entry point not found." );
 	CHECKCL( error );
 }
 
+// SourceChanged method
+// True if the kernel file or a file it includes changed since the build.
+// ----------------------------------------------------------------------------
+bool Kernel::SourceChanged()
+{
+	for (size_t i = 0; i < dependencies.size(); i++) if (ModifiedTime( dependencies[i] ) != dependencyTimes[i]) return true;
+	return false;
+}
+
 // Kernel destructor
 // ----------------------------------------------------------------------------
 Kernel::~Kernel()
@@ -482,6 +757,12 @@ bool Kernel::InitCL()
 	if (deviceUsed == -1) FatalError( "No capable OpenCL device found." );
 	device = getFirstDevice( context );
 	if (!CHECKCL( error )) return false;
+	// memory shared with the host: zero-copy buffers by default
+	cl_bool hostUnified = CL_FALSE;
+	cl_device_type deviceType = 0;
+	clGetDeviceInfo( device, CL_DEVICE_HOST_UNIFIED_MEMORY, sizeof( cl_bool ), &hostUnified, NULL );
+	clGetDeviceInfo( device, CL_DEVICE_TYPE, sizeof( cl_device_type ), &deviceType, NULL );
+	unifiedMemory = hostUnified == CL_TRUE || (deviceType & CL_DEVICE_TYPE_CPU) != 0;
 	// print device name
 	clGetDeviceInfo( devices[deviceUsed], CL_DEVICE_NAME, 1024, &device_string, NULL );
 	clGetDeviceInfo( devices[deviceUsed], CL_DEVICE_VERSION, 1024, &device_platform, NULL );
@@ -559,11 +840,17 @@ bool Kernel::InitCL()
 	{
 		printf( "identification failed.\n" );
 	}
-	// create a command-queue
-	queue = clCreateCommandQueue( context, devices[deviceUsed], CL_QUEUE_PROFILING_ENABLE, &error );
+	if (unifiedMemory) printf( "memory shared with the host: use ZEROCOPY buffers.\n" );
+	// create a command-queue; timestamps cost a little, so only when profiling
+#ifdef CL_PROFILING
+	const cl_command_queue_properties properties = CL_QUEUE_PROFILING_ENABLE;
+#else
+	const cl_command_queue_properties properties = 0;
+#endif
+	queue = clCreateCommandQueue( context, devices[deviceUsed], properties, &error );
 	if (!CHECKCL( error )) return false;
 	// create a second command queue for asynchronous copies
-	queue2 = clCreateCommandQueue( context, devices[deviceUsed], CL_QUEUE_PROFILING_ENABLE, &error );
+	queue2 = clCreateCommandQueue( context, devices[deviceUsed], properties, &error );
 	if (!CHECKCL( error )) return false;
 	// cleanup
 	delete devices;
@@ -595,6 +882,7 @@ void Kernel::SetArgument( int idx, Buffer* buffer )
 {
 	CheckCLStarted();
 	clSetKernelArg( kernel, idx, sizeof( cl_mem ), buffer->GetDevicePtr() );
+	if (buffer->zeroCopy && find( zeroCopyArgs.begin(), zeroCopyArgs.end(), buffer ) == zeroCopyArgs.end()) zeroCopyArgs.push_back( buffer );
 	if (buffer->type & Buffer::TARGET)
 	{
 		if (acqBuffer) FatalError( "Kernel can take only one texture target buffer argument." );
@@ -614,17 +902,20 @@ void Kernel::Run( const size_t count, const size_t localSize, cl_event* eventToW
 {
 	CheckCLStarted();
 	cl_int error;
+	for (Buffer* buffer : zeroCopyArgs) if (buffer->mapped) buffer->Unmap( queue, false, 0, buffer->size, "CopyToDevice" );
+	cl_event* e = ProfileEvent( eventToSet );
 	if (acqBuffer)
 	{
 		if (!Kernel::candoInterop) FatalError( "OpenGL interop functionality required but not available." );
 		CHECKCL( error = clEnqueueAcquireGLObjects( queue, 1, acqBuffer->GetDevicePtr(), 0, 0, 0 ) );
-		CHECKCL( error = clEnqueueNDRangeKernel( queue, kernel, 1, 0, &count, localSize == 0 ? 0 : &localSize, eventToWaitFor ? 1 : 0, eventToWaitFor, eventToSet ) );
+		CHECKCL( error = clEnqueueNDRangeKernel( queue, kernel, 1, 0, &count, localSize == 0 ? 0 : &localSize, eventToWaitFor ? 1 : 0, eventToWaitFor, e ) );
 		CHECKCL( error = clEnqueueReleaseGLObjects( queue, 1, acqBuffer->GetDevicePtr(), 0, 0, 0 ) );
 	}
 	else
 	{
-		CHECKCL( error = clEnqueueNDRangeKernel( queue, kernel, 1, 0, &count, localSize == 0 ? 0 : &localSize, eventToWaitFor ? 1 : 0, eventToWaitFor, eventToSet ) );
+		CHECKCL( error = clEnqueueNDRangeKernel( queue, kernel, 1, 0, &count, localSize == 0 ? 0 : &localSize, eventToWaitFor ? 1 : 0, eventToWaitFor, e ) );
 	}
+	Profile( name.c_str(), e, eventToSet );
 }
 
 void Kernel::Run2D( const int2 count, const int2 lsize, cl_event* eventToWaitFor, cl_event* eventToSet )
@@ -645,15 +936,82 @@ void Kernel::Run2D( const int2 count, const int2 lsize, cl_event* eventToWaitFor
 		localSize[1] = 4;
 	}
 	cl_int error;
+	for (Buffer* buffer : zeroCopyArgs) if (buffer->mapped) buffer->Unmap( queue, false, 0, buffer->size, "CopyToDevice" );
+	cl_event* e = ProfileEvent( eventToSet );
 	if (acqBuffer)
 	{
 		if (!Kernel::candoInterop) FatalError( "OpenGL interop functionality required but not available." );
 		CHECKCL( error = clEnqueueAcquireGLObjects( queue, 1, acqBuffer->GetDevicePtr(), 0, 0, 0 ) );
-		CHECKCL( error = clEnqueueNDRangeKernel( queue, kernel, 2, 0, workSize, localSize, eventToWaitFor ? 1 : 0, eventToWaitFor, eventToSet ) );
+		CHECKCL( error = clEnqueueNDRangeKernel( queue, kernel, 2, 0, workSize, localSize, eventToWaitFor ? 1 : 0, eventToWaitFor, e ) );
 		CHECKCL( error = clEnqueueReleaseGLObjects( queue, 1, acqBuffer->GetDevicePtr(), 0, 0, 0 ) );
 	}
 	else
 	{
-		CHECKCL( error = clEnqueueNDRangeKernel( queue, kernel, 2, 0, workSize, localSize, eventToWaitFor ? 1 : 0, eventToWaitFor, eventToSet ) );
+		CHECKCL( error = clEnqueueNDRangeKernel( queue, kernel, 2, 0, workSize, localSize, eventToWaitFor ? 1 : 0, eventToWaitFor, e ) );
 	}
+	Profile( name.c_str(), e, eventToSet );
 }
+
+// Profiling
+// Every command gets an event; its four timestamps split the time from
+// enqueueing to completion into host overhead (queued to submitted), waiting
+// on the device (submitted to started) and running (started to ended).
+// ----------------------------------------------------------------------------
+cl_event* Kernel::ProfileEvent( cl_event* eventToSet )
+{
+#ifdef CL_PROFILING
+	static cl_event own; // for commands without an event of the caller
+	return eventToSet ? eventToSet : &own;
+#else
+	return eventToSet;
+#endif
+}
+
+void Kernel::Profile( const char* name, cl_event* event, cl_event* eventToSet, const bool transfer )
+{
+#ifdef CL_PROFILING
+	if (event == eventToSet) clRetainEvent( *event ); // the caller releases it as well
+	profiled.push_back( { *event, name, transfer } );
+#endif
+}
+
+char* Kernel::ProfileReport( char* t )
+{
+#ifdef CL_PROFILING
+	// commands that completed; the others are reported next time
+	size_t pending = 0;
+	for (Profiled& p : profiled)
+	{
+		cl_int status = CL_COMPLETE;
+		clGetEventInfo( p.event, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof( cl_int ), &status, 0 );
+		if (status > CL_COMPLETE) { profiled[pending++] = p; continue; }
+		cl_ulong time[4] = {}; // queued, submitted, started, ended
+		const cl_profiling_info info[4] = { CL_PROFILING_COMMAND_QUEUED, CL_PROFILING_COMMAND_SUBMIT, CL_PROFILING_COMMAND_START, CL_PROFILING_COMMAND_END };
+		bool valid = status == CL_COMPLETE;
+		for (int i = 0; i < 4 && valid; i++) valid = clGetEventProfilingInfo( p.event, info[i], sizeof( cl_ulong ), &time[i], 0 ) == CL_SUCCESS;
+		clReleaseEvent( p.event );
+		if (!valid) continue; // failed command
+		size_t i = 0;
+		while (i < timings.size() && timings[i].name != p.name) i++;
+		if (i == timings.size()) timings.push_back( { p.name, p.transfer, 0, 0, 0, 0 } );
+		timings[i].count++;
+		timings[i].host += time[1] - time[0], timings[i].wait += time[2] - time[1], timings[i].run += time[3] - time[2];
+	}
+	profiled.resize( pending );
+	// the most expensive first
+	sort( timings.begin(), timings.end(), []( const Timing& a, const Timing& b ) { return a.run > b.run; } );
+	int64_t compute = 0, transfers = 0, host = 0;
+	for (Timing& timing : timings) if (timing.count > 0)
+	{
+		t += sprintf( t, "cl %-16.16s %4i x, run %7.3f ms, wait %7.3f ms, host %7.3f ms\n", timing.name.c_str(),
+			(int)timing.count, timing.run * 1e-6f, timing.wait * 1e-6f, timing.host * 1e-6f );
+		(timing.transfer ? transfers : compute) += timing.run, host += timing.host;
+		timing.count = timing.host = timing.wait = timing.run = 0;
+	}
+	if (compute + transfers + host > 0)
+		t += sprintf( t, "cl: compute %7.3f ms, transfers %7.3f ms, host overhead %7.3f ms\n", compute * 1e-6f, transfers * 1e-6f, host * 1e-6f );
+#endif
+	return t;
+}
+
+#endif
@@ -5,10 +5,16 @@
 #pragma once
 
 // OpenCL buffer
+// ZEROCOPY buffers let the device work in the host memory itself, which pays
+// off on devices that share memory with the host (CPUs, most integrated GPUs,
+// see Kernel::unifiedMemory). Copying then becomes mapping or unmapping the
+// buffer, which hands it over without moving data. The host may access it
+// after construction and after CopyFromDevice; the device after CopyToDevice,
+// which a kernel that takes the buffer as an argument does when it runs.
 class Buffer
 {
 public:
-	enum { DEFAULT = 0, TEXTURE = 8, TARGET = 16, READONLY = 1, WRITEONLY = 2 };
+	enum { DEFAULT = 0, TEXTURE = 8, TARGET = 16, READONLY = 1, WRITEONLY = 2, ZEROCOPY = 32 };
 	// constructor / destructor
 	Buffer() : hostBuffer( 0 ) {}
 	Buffer( unsigned int N, void* ptr = 0, unsigned int t = DEFAULT );
@@ -20,11 +26,17 @@ public:
 	void CopyFromDevice( bool blocking = true );
 	void CopyTo( Buffer* buffer );
 	void Clear();
+	// zero-copy hand-over
+	void Map( cl_command_queue queue, const bool blocking, const char* name );
+	void Unmap( cl_command_queue queue, const bool blocking, cl_event* eventToSet, const size_t bytes, const char* name );
 	// data members
 	unsigned int* hostBuffer;
 	cl_mem deviceBuffer = 0;
 	unsigned int type, size /* in bytes */, textureID;
 	bool ownData, aligned;
+	bool zeroCopy = false, mapped = false; // mapped: the host has it
+	cl_command_queue mapQueue = 0; // of the current mapping
+	cl_event handOver = 0; // the last map or unmap
 };
 
 // OpenCL kernel
@@ -43,6 +55,15 @@ public:
 	static cl_command_queue& GetQueue2() { return queue2; }
 	static cl_context& GetContext() { return context; }
 	static cl_device_id& GetDevice() { return device; }
+	// the kernel file and the files it includes; for hot reloading
+	const vector<string>& GetDependencies() { return dependencies; }
+	bool SourceChanged();
+	// profiling, with CL_PROFILING in common.h: the queued, submitted, started
+	// and ended times of every Run and Buffer copy, summed per kernel name;
+	// call once per frame, from the thread that enqueues
+	static char* ProfileReport( char* t ); // appends the timings since the previous report, returns the end
+	static cl_event* ProfileEvent( cl_event* eventToSet ); // the event to pass to an enqueue call
+	static void Profile( const char* name, cl_event* event, cl_event* eventToSet, const bool transfer = false );
 	// run methods
 #if 1
 	void Run( cl_event* eventToWaitFor = 0, cl_event* eventToSet = 0 );
@@ -157,7 +178,7 @@ public:
 		S( 16, q ), S( 17, r ), S( 18, t ), S( 19, u );
 	}
 	template<T_ T> void S( uint i, T t ) { SetArgument( i, t ); }
-	void InitArgs() { acqBuffer = 0; /* nothing to acquire until told otherwise */ }
+	void InitArgs() { acqBuffer = 0; /* nothing to acquire until told otherwise */ zeroCopyArgs.clear(); }
 #undef T_
 private:
 	void SetArgument( int idx, cl_mem* buffer );
@@ -176,9 +197,13 @@ public:
 private:
 	// data members
 	Buffer* acqBuffer = 0;
+	vector<Buffer*> zeroCopyArgs; // unmapped before the kernel runs
 	cl_kernel kernel;
 	cl_mem vbo_cl;
 	cl_program program;
+	string name; // entry point
+	vector<string> dependencies;
+	vector<int64_t> dependencyTimes; // at build time
 	inline static cl_device_id device;
 	inline static cl_context context; // simplifies some things, but limits us to one device
 	inline static cl_command_queue queue, queue2;
@@ -186,6 +211,11 @@ private:
 	inline static bool isNVidia = false, isAMD = false, isIntel = false, isOther = false;
 	inline static bool isAmpere = false, isTuring = false, isPascal = false;
 	inline static int vendorLines = 0;
+	struct Profiled { cl_event event; string name; bool transfer; };
+	struct Timing { string name; bool transfer; int64_t count, host, wait, run; };
+	inline static vector<Profiled> profiled; // enqueued; not reported yet
+	inline static vector<Timing> timings;
 public:
 	inline static bool candoInterop = false, clStarted = false;
+	inline static bool unifiedMemory = false; // ZEROCOPY buffers avoid copies
 };
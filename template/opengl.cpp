@@ -4,6 +4,9 @@
 
 #include "precomp.h"
 
+// no OpenGL in headless builds
+#ifndef HEADLESS
+
 extern bool IGP_detected;
 
 // OpenGL helper functions
@@ -144,14 +147,27 @@ void GLTexture::Bind( const uint slot )
 void GLTexture::CopyFrom( Surface* src )
 {
 	glBindTexture( GL_TEXTURE_2D, ID );
-	glTexImage2D( GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_BGRA, GL_UNSIGNED_BYTE, src->pixels );
+	const int4 r = src->trackDirty && !src->parent ? src->TakeChanged() : int4( 0, 0, width - 1, height - 1 );
+	glPixelStorei( GL_UNPACK_ROW_LENGTH, src->pitch );
+	if (r.y == 0 && r.w == (int)height - 1)
+	{
+		glTexImage2D( GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_BGRA, GL_UNSIGNED_BYTE, src->pixels );
+	}
+	else if (r.y <= r.w)
+	{
+		// upload only the rows that changed since the previous frame
+		glTexSubImage2D( GL_TEXTURE_2D, 0, 0, r.y, width, r.w - r.y + 1, GL_BGRA, GL_UNSIGNED_BYTE, src->pixels + r.y * src->pitch );
+	}
+	glPixelStorei( GL_UNPACK_ROW_LENGTH, 0 );
 	CheckGL();
 }
 
 void GLTexture::CopyTo( Surface* dst )
 {
 	glBindTexture( GL_TEXTURE_2D, ID );
+	glPixelStorei( GL_PACK_ROW_LENGTH, dst->pitch );
 	glGetTexImage( GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, dst->pixels );
+	glPixelStorei( GL_PACK_ROW_LENGTH, 0 );
 	CheckGL();
 }
 
@@ -253,3 +269,6 @@ void Shader::SetUInt( const char* name, const uint v )
 	glUniform1ui( glGetUniformLocation( ID, name ), v );
 	CheckGL();
 }
+
+
+#endif
\ No newline at end of file
@@ -0,0 +1,233 @@
+// Template, IGAD version 3
+// Get the latest version from: https://github.com/jbikker/tmpl8
+// IGAD/NHTV/UU - Jacco Bikker - 2006-2023
+
+#include "precomp.h"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// PerfCounters implementation
+// ----------------------------------------------------------------------------
+
+bool PerfCounters::Init()
+{
+#ifdef __linux__
+	lock_guard<mutex> l( lock );
+	if (available) return true;
+	bool opened = Open( 0 );
+	for (size_t i = 0; i < threads.size() && opened; i++) opened = Open( threads[i] );
+	if (!opened)
+	{
+		printf( "perf_event_open failed; check /proc/sys/kernel/perf_event_paranoid.\n" );
+		Close();
+		return false;
+	}
+	available = true;
+	return true;
+#else
+	printf( "hardware performance counters are only supported on Linux.\n" );
+	return false;
+#endif
+}
+
+void PerfCounters::AddThread()
+{
+#ifdef __linux__
+	lock_guard<mutex> l( lock );
+	const int tid = (int)syscall( SYS_gettid );
+	threads.push_back( tid );
+	if (available && !Open( tid )) printf( "perf_event_open failed for job thread %i.\n", tid );
+#endif
+}
+
+// a group of all counters for thread 'tid' (0: the calling thread); they are
+// scheduled together and read with a single system call
+bool PerfCounters::Open( const int tid )
+{
+#ifdef __linux__
+	const uint64_t config[EVENTS][2] = {
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES }, // last level cache
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES }
+	};
+	array<int, EVENTS> fd;
+	fd.fill( -1 );
+	for (int i = 0; i < EVENTS; i++)
+	{
+		perf_event_attr attr;
+		memset( &attr, 0, sizeof( attr ) );
+		attr.size = sizeof( attr );
+		attr.type = (uint)config[i][0];
+		attr.config = config[i][1];
+		attr.disabled = i == 0 ? 1 : 0; // leader starts the group
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		// the enabled and running times reveal multiplexing: with more counters
+		// than the PMU has, the group only counts part of the time
+		attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+		fd[i] = (int)syscall( __NR_perf_event_open, &attr, tid, -1, i == 0 ? -1 : fd[0], 0 );
+		if (fd[i] == -1)
+		{
+			for (int j = i - 1; j >= 0; j--) close( fd[j] );
+			return false;
+		}
+	}
+	ioctl( fd[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP );
+	ioctl( fd[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP );
+	groups.push_back( fd );
+	owners.push_back( tid ? tid : (int)syscall( SYS_gettid ) );
+	opened++;
+	return true;
+#else
+	return false;
+#endif
+}
+
+void PerfCounters::Close()
+{
+#ifdef __linux__
+	for (array<int, EVENTS>& fd : groups) for (int i = EVENTS - 1; i >= 0; i--) close( fd[i] );
+#endif
+	groups.clear();
+	owners.clear();
+	opened++;
+	available = false;
+}
+
+void PerfCounters::Shutdown()
+{
+	lock_guard<mutex> l( lock );
+	Close();
+}
+
+void PerfCounters::Read( uint64_t* values )
+{
+	for (int i = 0; i < EVENTS; i++) values[i] = 0;
+	lock_guard<mutex> l( lock );
+	for (array<int, EVENTS>& fd : groups)
+	{
+		uint64_t group[EVENTS];
+		if (ReadGroup( fd[0], group )) for (int i = 0; i < EVENTS; i++) values[i] += group[i];
+	}
+}
+
+bool PerfCounters::ReadGroup( const int leader, uint64_t* values )
+{
+#ifdef __linux__
+	// layout: nr, time enabled, time running, then one value per counter
+	uint64_t data[3 + EVENTS];
+	if (read( leader, data, sizeof( data ) ) != (ssize_t)sizeof( data )) return false;
+	// scaled up to the time enabled, if the group was multiplexed
+	const uint64_t enabled = data[1], running = data[2];
+	if (running < enabled) currentScaled = true;
+	for (int i = 0; i < EVENTS; i++) values[i] = running == 0 ? 0 : running == enabled ? data[i + 3] : (uint64_t)(data[i + 3] * ((double)enabled / running));
+	return true;
+#else
+	return false;
+#endif
+}
+
+// the group of the calling thread, looked up again after groups changed
+int PerfCounters::Leader()
+{
+#ifdef __linux__
+	thread_local int leader = -1, seen = -1;
+	if (seen != opened.load( memory_order_acquire ))
+	{
+		lock_guard<mutex> l( lock );
+		const int tid = (int)syscall( SYS_gettid );
+		leader = -1, seen = opened;
+		for (size_t i = 0; i < groups.size(); i++) if (owners[i] == tid) leader = groups[i][0];
+	}
+	return leader;
+#else
+	return -1;
+#endif
+}
+
+void PerfCounters::Pause()
+{
+	if (!available) return;
+#ifdef __linux__
+	const int leader = Leader();
+	if (leader >= 0) ioctl( leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP );
+#endif
+}
+
+void PerfCounters::Resume()
+{
+	if (!available) return;
+#ifdef __linux__
+	const int leader = Leader();
+	if (leader >= 0) ioctl( leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP );
+#endif
+}
+
+PerfCounters::Task::Task( const uint p ) : phase( p )
+{
+	const int leader = available ? Leader() : -1;
+	if (leader < 0 || !ReadGroup( leader, start )) phase = PHASES; // not counted
+	startTime = chrono::high_resolution_clock::now();
+}
+
+PerfCounters::Task::~Task()
+{
+	uint64_t values[EVENTS];
+	if (phase == PHASES || !ReadGroup( Leader(), values )) return;
+	chrono::duration<double> span = chrono::high_resolution_clock::now() - startTime;
+	lock_guard<mutex> l( lock );
+	for (int i = 0; i < EVENTS; i++) current[phase][i] += values[i] - start[i];
+	currentSeconds[phase] += (float)span.count();
+}
+
+void PerfCounters::Begin( const uint /* phase */ )
+{
+	if (!available) return;
+	startTime = chrono::high_resolution_clock::now();
+	Read( start );
+}
+
+void PerfCounters::End( const uint phase )
+{
+	if (!available) return;
+	uint64_t values[EVENTS];
+	Read( values );
+	chrono::duration<double> span = chrono::high_resolution_clock::now() - startTime;
+	for (int i = 0; i < EVENTS; i++) current[phase][i] += values[i] - start[i];
+	currentSeconds[phase] += (float)span.count();
+}
+
+void PerfCounters::NextFrame()
+{
+	if (!available) return;
+	memcpy( frame, current, sizeof( frame ) );
+	memcpy( frameSeconds, currentSeconds, sizeof( frameSeconds ) );
+	frameScaled = currentScaled, currentScaled = false;
+	memset( current, 0, sizeof( current ) );
+	memset( currentSeconds, 0, sizeof( currentSeconds ) );
+}
+
+const char* PerfCounters::PhaseName( const uint phase )
+{
+	static const char* name[PHASES] = { "integration", "constraints", "draw" };
+	return phase < PHASES ? name[phase] : "?";
+}
+
+char* PerfCounters::Report( char* t )
+{
+	if (!available) return t;
+	for (uint i = 0; i < PHASES; i++)
+	{
+		const float cycles = (float)frame[i][CYCLES], instr = (float)frame[i][INSTRUCTIONS];
+		t += sprintf( t, "%11s: %5.1f ms %7.1fm cyc %7.1fm ins (ipc %4.2f) %7.1fk llc %7.1fk br%s\n", PhaseName( i ),
+			frameSeconds[i] * 1000, cycles * 1e-6f, instr * 1e-6f, cycles > 0 ? instr / cycles : 0,
+			frame[i][LLC_MISSES] * 1e-3f, frame[i][BRANCH_MISSES] * 1e-3f, frameScaled ? " (multiplexed)" : "" );
+	}
+	return t;
+}
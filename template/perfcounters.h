@@ -0,0 +1,75 @@
+// Template, IGAD version 3
+// Get the latest version from: https://github.com/jbikker/tmpl8
+// IGAD/NHTV/UU - Jacco Bikker - 2006-2023
+
+#pragma once
+
+// Hardware performance counters (Linux perf_event_open), accumulated per
+// phase of a frame. Compiled in only when PERFCOUNTERS is defined in
+// common.h; otherwise the PERF_BEGIN / PERF_END macros expand to nothing.
+// On other platforms Init() fails and all calls are no-ops.
+// Counters only count the thread they were opened for, and phases run on
+// the job system. Every job thread therefore gets a counter group of its
+// own (AddThread), and a phase is the sum over all groups. Job threads
+// stop their counters while they wait for jobs (Pause), so phases count
+// work, not spinning. Phases that overlap, like the stages of a task graph,
+// are counted per task instead (PERF_TASK); their time is the sum over the
+// threads.
+class PerfCounters
+{
+public:
+	enum { CYCLES = 0, INSTRUCTIONS, LLC_MISSES, BRANCH_MISSES, EVENTS };
+	enum { INTEGRATION = 0, CONSTRAINTS, DRAW, PHASES };
+	static bool Init(); // for the calling thread and the job threads
+	static void Shutdown();
+	static void AddThread(); // by every job thread, when it starts
+	static void Pause(); // stops the counters of the calling thread
+	static void Resume();
+	static void Begin( const uint phase );
+	static void End( const uint phase );
+	// counts the calling thread from construction to destruction
+	class Task
+	{
+	public:
+		Task( const uint phase );
+		~Task();
+	private:
+		uint phase;
+		uint64_t start[EVENTS];
+		chrono::high_resolution_clock::time_point startTime;
+	};
+	static void NextFrame();
+	// results of the last completed frame
+	static uint64_t Count( const uint phase, const uint event ) { return frame[phase][event]; }
+	static float Seconds( const uint phase ) { return frameSeconds[phase]; }
+	static const char* PhaseName( const uint phase );
+	static char* Report( char* t ); // appends one line per phase, returns the end
+	inline static bool available = false;
+private:
+	static void Read( uint64_t* values );
+	static bool ReadGroup( const int leader, uint64_t* values );
+	static int Leader(); // of the group of the calling thread; -1 if it has none
+	static bool Open( const int tid );
+	static void Close();
+	inline static mutex lock; // guards groups and threads
+	inline static vector<array<int, EVENTS>> groups; // per thread; fds, the first leads
+	inline static vector<int> owners; // the thread of each group
+	inline static atomic<int> opened{ 0 }; // changes when groups are opened or closed
+	inline static vector<int> threads; // job threads; opened by Init if they started before it
+	inline static uint64_t start[EVENTS] = {};
+	inline static uint64_t current[PHASES][EVENTS] = {}, frame[PHASES][EVENTS] = {};
+	inline static float currentSeconds[PHASES] = {}, frameSeconds[PHASES] = {};
+	inline static atomic<bool> currentScaled{ false }; // multiplexed: estimates
+	inline static bool frameScaled = false;
+	inline static chrono::high_resolution_clock::time_point startTime;
+};
+
+#ifdef PERFCOUNTERS
+#define PERF_BEGIN( phase ) PerfCounters::Begin( PerfCounters::phase )
+#define PERF_END( phase ) PerfCounters::End( PerfCounters::phase )
+#define PERF_TASK( phase ) PerfCounters::Task perfTask( PerfCounters::phase )
+#else
+#define PERF_BEGIN( phase )
+#define PERF_END( phase )
+#define PERF_TASK( phase )
+#endif
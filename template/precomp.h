@@ -7,8 +7,14 @@
 #include <fstream>
 #include <vector>
 #include <list>
+#include <deque>
+#include <functional>
 #include <string>
 #include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <unordered_map>
 #include <math.h>
 #include <algorithm>
 #include <assert.h>
@@ -62,9 +68,14 @@ using namespace std;
 // namespaces
 using namespace Tmpl8;
 
+// global project settigs; shared with OpenCL
+#include "common.h"
+
 // clang-format off
 
-// windows.h: disable as much as possible to speed up compilation.
+// windows.h: disable as much as possible to speed up compilation. Headless
+// builds only need it for the Windows versions of the platform code.
+#if !defined HEADLESS || defined _WIN32
 #define NOMINMAX
 #ifndef WIN32_LEAN_AND_MEAN
 #define WIN32_LEAN_AND_MEAN
@@ -108,6 +119,10 @@ using namespace Tmpl8;
 #define NOMCX
 #define NOIME
 #include "windows.h"
+#endif
+
+// no window, OpenGL or OpenCL in headless builds
+#ifndef HEADLESS
 
 // OpenCL headers
 #define CL_USE_DEPRECATED_OPENCL_2_0_APIS // safe; see https://stackoverflow.com/a/28500846
@@ -122,13 +137,15 @@ using namespace Tmpl8;
 #include <GLFW/glfw3.h>
 #include <GLFW/glfw3native.h>
 
-// zlib
-#include "zlib.h"
-
 // opencl & opencl
 #include "opencl.h"
 #include "opengl.h"
 
+#endif
+
+// zlib
+#include "zlib.h"
+
 // fatal error reporting (with a pretty window)
 #define FATALERROR( fmt, ... ) FatalError( "Error on line %d of %s: " fmt "\n", __LINE__, __FILE__, ##__VA_ARGS__ )
 #define FATALERROR_IF( condition, fmt, ... ) do { if ( ( condition ) ) FATALERROR( fmt, ##__VA_ARGS__ ); } while ( 0 )
@@ -149,48 +166,12 @@ struct Timer
 	chrono::high_resolution_clock::time_point start;
 };
 
-// Nils's jobmanager
-class Job
-{
-public:
-	virtual void Main() = 0;
-protected:
-	friend class JobThread;
-	void RunCodeWrapper();
-};
-class JobThread
-{
-public:
-	void CreateAndStartThread( unsigned int threadId );
-	void Go();
-	void BackgroundTask();
-	HANDLE m_GoSignal, m_ThreadHandle;
-	int m_ThreadID;
-};
-class JobManager	// singleton class!
-{
-protected:
-	JobManager( unsigned int numThreads );
-public:
-	~JobManager();
-	static void CreateJobManager( unsigned int numThreads );
-	static JobManager* GetJobManager();
-	static void GetProcessorCount( uint& cores, uint& logical );
-	void AddJob2( Job* a_Job );
-	unsigned int GetNumThreads() { return m_NumThreads; }
-	void RunJobs();
-	void ThreadDone( unsigned int n );
-	int MaxConcurrent() { return m_NumThreads; }
-protected:
-	friend class JobThread;
-	Job* GetNextJob();
-	static JobManager* m_JobManager;
-	Job* m_JobList[256];
-	CRITICAL_SECTION m_CS;
-	HANDLE m_ThreadDone[64];
-	unsigned int m_NumThreads, m_JobCount;
-	JobThread* m_JobThreadList;
-};
+// processor topology and thread pinning
+#include "topology.h"
+
+// job system, and its timeline recording
+#include "jobtrace.h"
+#include "jobmanager.h"
 
 // forward declaration of helper functions
 void FatalError( const char* fmt, ... );
@@ -200,9 +181,20 @@ bool RemoveFile( const char* f );
 string TextFileRead( const char* _File );
 int LineCount( const string s );
 void TextFileWrite( const string& text, const char* _File );
+void RunBenchmarks();
+void CheckKernelSources(); // in opencl.cpp; one of the self-checks of RunBenchmarks
 
-// global project settigs; shared with OpenCL
-#include "common.h"
+// hardware performance counters; enabled via PERFCOUNTERS in common.h
+#include "perfcounters.h"
+
+// frame time histograms
+#include "framestats.h"
+
+// multithreaded tile-binned rendering
+#include "binner.h"
+
+// headless frame output to files or a pipe
+#include "framesink.h"
 
 // InstructionSet.cpp
 // Compile by using: cl /EHsc /W4 InstructionSet.cpp
@@ -12,7 +12,8 @@ Sprite::Sprite( Surface* a_Surface, unsigned int a_NumFrames ) :
 	numFrames( a_NumFrames ),
 	currentFrame( 0 ),
 	flags( 0 ),
-	start( new unsigned int* [a_NumFrames] ),
+	run( 0 ),
+	firstRun( 0 ),
 	surface( a_Surface )
 {
 	InitializeStartData();
@@ -21,71 +22,131 @@ Sprite::Sprite( Surface* a_Surface, unsigned int a_NumFrames ) :
 Sprite::~Sprite()
 {
 	delete surface;
-	for (unsigned int i = 0; i < numFrames; i++) delete start[i];
-	delete start;
+	delete[] run;
+	delete[] firstRun;
 }
 
 void Sprite::Draw( Surface* a_Target, int a_X, int a_Y )
 {
-	if ((a_X < -width) || (a_X > ( a_Target->width + width ))) return;
-	if ((a_Y < -height) || (a_Y > ( a_Target->height + height ))) return;
-	int x1 = a_X, x2 = a_X + width;
-	int y1 = a_Y, y2 = a_Y + height;
-	uint* src = GetBuffer() + currentFrame * width;
-	if (x1 < 0) src += -x1, x1 = 0;
-	if (x2 > a_Target->width) x2 = a_Target->width;
-	if (y1 < 0) src += -y1 * width * numFrames, y1 = 0;
-	if (y2 > a_Target->height) y2 = a_Target->height;
-	uint* dest = a_Target->pixels;
-	int xs;
-	const int dpitch = a_Target->width;
-	if ((x2 > x1) && (y2 > y1))
+	a_Target->MarkDirty( a_X, a_Y, a_X + width - 1, a_Y + height - 1 );
+	Draw( a_Target, a_X, a_Y, currentFrame, 0, 0, a_Target->width, a_Target->height );
+}
+
+// copy a fully opaque run: 8 pixels at a time, a masked store for the rest
+static inline void CopyRun( uint* dst, const uint* src, int n )
+{
+	if (!CPUCaps::HW_AVX2) { memcpy( dst, src, n * 4 ); return; }
+	for (; n >= 8; n -= 8, dst += 8, src += 8) _mm256_storeu_si256( (__m256i*)dst, _mm256_loadu_si256( (const __m256i*)src ) );
+	if (n == 0) return;
+	const __m256i mask = _mm256_cmpgt_epi32( _mm256_set1_epi32( n ), _mm256_setr_epi32( 0, 1, 2, 3, 4, 5, 6, 7 ) );
+	_mm256_maskstore_epi32( (int*)dst, mask, _mm256_maskload_epi32( (const int*)src, mask ) );
+}
+
+// draw frame a_Frame, clipped to [a_X1, a_X2) x [a_Y1, a_Y2) on the target;
+// does not mark the target dirty. Only the opaque runs are visited.
+void Sprite::Draw( Surface* a_Target, int a_X, int a_Y, unsigned int a_Frame, int a_X1, int a_Y1, int a_X2, int a_Y2 )
+{
+	if ((a_X + width <= a_X1) || (a_X >= a_X2)) return;
+	if ((a_Y + height <= a_Y1) || (a_Y >= a_Y2)) return;
+	const int x1 = max( a_X, a_X1 ), x2 = min( a_X + width, a_X2 );
+	const int y1 = max( a_Y, a_Y1 ), y2 = min( a_Y + height, a_Y2 );
+	const int spitch = surface->pitch, dpitch = a_Target->pitch;
+	for (int y = y1; y < y2; y++)
 	{
-		unsigned int addr = y1 * dpitch + x1;
-		const int w = x2 - x1;
-		const int h = y2 - y1;
-		for (int y = 0; y < h; y++)
+		const unsigned int line = a_Frame * height + (y - a_Y);
+		const uint* src = GetBuffer() + a_Frame * width + (y - a_Y) * spitch - a_X;
+		uint* dest = a_Target->pixels + y * dpitch;
+		for (unsigned int i = firstRun[line]; i < firstRun[line + 1]; i++)
 		{
-			const int line = y + (y1 - a_Y);
-			const int lsx = start[currentFrame][line] + a_X;
-			xs = (lsx > x1) ? lsx - x1 : 0;
-			for (int x = xs; x < w; x++)
-			{
-				const uint c1 = *(src + x);
-				if (c1 & 0xffffff) *(dest + addr + x) = c1;
-			}
-			addr += dpitch;
-			src += width * numFrames;
+			const int rx1 = max( x1, a_X + run[i].x ), rx2 = min( x2, a_X + run[i].x + run[i].y );
+			if (rx2 > rx1) CopyRun( dest + rx1, src + rx1, rx2 - rx1 );
 		}
 	}
 }
 
-void Sprite::DrawScaled( int a_X, int a_Y, int a_Width, int a_Height, Surface* a_Target )
+// draw the current frame scaled to a_Width x a_Height pixels, clipped to the
+// target. Source columns are looked up in a per-column table, source rows
+// once per row. The bilinear path filters 2x2 texels in 16.16 fixed point;
+// a pixel is drawn if its nearest texel is opaque.
+void Sprite::DrawScaled( int a_X, int a_Y, int a_Width, int a_Height, Surface* a_Target, bool a_Bilinear )
 {
-	if ((a_Width == 0) || (a_Height == 0)) return;
-	for (int x = 0; x < a_Width; x++) for (int y = 0; y < a_Height; y++)
+	if ((a_Width <= 0) || (a_Height <= 0)) return;
+	const int x1 = max( 0, a_X ), x2 = min( a_Target->width, a_X + a_Width );
+	const int y1 = max( 0, a_Y ), y2 = min( a_Target->height, a_Y + a_Height );
+	if ((x2 <= x1) || (y2 <= y1)) return;
+	a_Target->MarkDirty( x1, y1, x2 - 1, y2 - 1 );
+	const int spitch = surface->pitch, dpitch = a_Target->pitch;
+	const uint* frame = GetBuffer() + currentFrame * width;
+	thread_local vector<int> column; // per thread: sprites may be drawn from jobs
+	column.resize( x2 - x1 );
+	if (!a_Bilinear)
+	{
+		// exact integer mapping: u = x * width / a_Width
+		for (int x = x1; x < x2; x++) column[x - x1] = (int)((int64_t)(x - a_X) * width / a_Width);
+		for (int y = y1; y < y2; y++)
+		{
+			const uint* src = frame + (int)((int64_t)(y - a_Y) * height / a_Height) * spitch;
+			uint* dst = a_Target->pixels + x1 + y * dpitch;
+			for (int x = 0; x < x2 - x1; x++)
+			{
+				const uint c = src[column[x]];
+				if (c & 0xffffff) dst[x] = c;
+			}
+		}
+		return;
+	}
+	// texel centers in 16.16 fixed point; column holds u for each pixel
+	const int du = (int)(((int64_t)width << 16) / a_Width), dv = (int)(((int64_t)height << 16) / a_Height);
+	for (int x = x1; x < x2; x++) column[x - x1] = max( 0, (int)(((int64_t)(2 * (x - a_X) + 1) * du >> 1) - 0x8000) );
+	const __m128i zero = _mm_setzero_si128();
+	for (int y = y1; y < y2; y++)
 	{
-		int u = (int)((float)x * ((float)width / (float)a_Width));
-		int v = (int)((float)y * ((float)height / (float)a_Height));
-		uint color = GetBuffer()[u + v * width * numFrames];
-		if (color & 0xffffff) a_Target->pixels[a_X + x + ((a_Y + y) * a_Target->width)] = color;
+		const int v = max( 0, (int)(((int64_t)(2 * (y - a_Y) + 1) * dv >> 1) - 0x8000) );
+		const int v0 = min( v >> 16, height - 1 ), v1 = min( v0 + 1, height - 1 ), fy = (v >> 8) & 255;
+		const uint* row0 = frame + v0 * spitch, * row1 = frame + v1 * spitch, * nearRow = fy < 128 ? row0 : row1;
+		const __m128i wy = _mm_set_epi16( fy, fy, fy, fy, 256 - fy, 256 - fy, 256 - fy, 256 - fy );
+		uint* dst = a_Target->pixels + x1 + y * dpitch;
+		for (int x = 0; x < x2 - x1; x++)
+		{
+			const int u = column[x], u0 = min( u >> 16, width - 1 ), u1 = min( u0 + 1, width - 1 ), fx = (u >> 8) & 255;
+			if (!(nearRow[fx < 128 ? u0 : u1] & 0xffffff)) continue;
+			// 16 bits per channel: texels (u0, u1) of both rows
+			const __m128i wx = _mm_set_epi16( fx, fx, fx, fx, 256 - fx, 256 - fx, 256 - fx, 256 - fx );
+			const __m128i t0 = _mm_unpacklo_epi8( _mm_unpacklo_epi32( _mm_cvtsi32_si128( row0[u0] ), _mm_cvtsi32_si128( row0[u1] ) ), zero );
+			const __m128i t1 = _mm_unpacklo_epi8( _mm_unpacklo_epi32( _mm_cvtsi32_si128( row1[u0] ), _mm_cvtsi32_si128( row1[u1] ) ), zero );
+			// horizontal: weighted sum of the two halves; top row in the low half, bottom row in the high half
+			const __m128i h0 = _mm_mullo_epi16( t0, wx ), h1 = _mm_mullo_epi16( t1, wx );
+			const __m128i top = _mm_srli_epi16( _mm_add_epi16( h0, _mm_srli_si128( h0, 8 ) ), 8 );
+			const __m128i bottom = _mm_srli_epi16( _mm_add_epi16( h1, _mm_srli_si128( h1, 8 ) ), 8 );
+			// vertical
+			const __m128i vv = _mm_mullo_epi16( _mm_unpacklo_epi64( top, bottom ), wy );
+			const __m128i c = _mm_srli_epi16( _mm_add_epi16( vv, _mm_srli_si128( vv, 8 ) ), 8 );
+			dst[x] = (uint)_mm_cvtsi128_si32( _mm_packus_epi16( c, zero ) );
+		}
 	}
 }
 
+// split each row of each frame in runs of opaque pixels; a pixel is
+// transparent if its color (ignoring alpha) is black.
 void Sprite::InitializeStartData()
 {
-	for (unsigned int f = 0; f < numFrames; ++f)
+	delete[] run;
+	delete[] firstRun;
+	vector<int2> runs;
+	firstRun = new unsigned int[numFrames * height + 1];
+	for (unsigned int f = 0; f < numFrames; ++f) for (int y = 0; y < height; ++y)
 	{
-		start[f] = new unsigned int[height];
-		for (int y = 0; y < height; ++y)
+		firstRun[f * height + y] = (unsigned int)runs.size();
+		const uint* addr = GetBuffer() + f * width + y * surface->pitch;
+		for (int x = 0; x < width; )
 		{
-			start[f][y] = width;
-			uint* addr = GetBuffer() + f * width + y * width * numFrames;
-			for (int x = 0; x < width; ++x) if (addr[x])
-			{
-				start[f][y] = x;
-				break;
-			}
+			if (!(addr[x] & 0xffffff)) { x++; continue; }
+			const int x0 = x;
+			while (x < width && (addr[x] & 0xffffff)) x++;
+			runs.push_back( int2( x0, x - x0 ) );
 		}
 	}
+	firstRun[numFrames * height] = (unsigned int)runs.size();
+	run = new int2[runs.size() + 1];
+	if (runs.size()) memcpy( run, runs.data(), runs.size() * sizeof( int2 ) );
 }
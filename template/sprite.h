@@ -16,7 +16,8 @@ public:
 	~Sprite();
 	// methods
 	void Draw( Surface* a_Target, int a_X, int a_Y );
-	void DrawScaled( int a_X, int a_Y, int a_Width, int a_Height, Surface* a_Target );
+	void Draw( Surface* a_Target, int a_X, int a_Y, unsigned int a_Frame, int a_X1, int a_Y1, int a_X2, int a_Y2 );
+	void DrawScaled( int a_X, int a_Y, int a_Width, int a_Height, Surface* a_Target, bool a_Bilinear = false );
 	void SetFlags( unsigned int a_Flags ) { flags = a_Flags; }
 	void SetFrame( unsigned int a_Index ) { currentFrame = a_Index; }
 	unsigned int GetFlags() const { return flags; }
@@ -24,6 +25,7 @@ public:
 	int GetHeight() { return height; }
 	uint* GetBuffer() { return surface->pixels; }
 	unsigned int Frames() { return numFrames; }
+	unsigned int GetFrame() const { return currentFrame; }
 	Surface* GetSurface() { return surface; }
 	void InitializeStartData();
 private:
@@ -32,7 +34,8 @@ private:
 	unsigned int numFrames;
 	unsigned int currentFrame;
 	unsigned int flags;
-	unsigned int** start;
+	int2* run;					// opaque runs (x, length), row by row
+	unsigned int* firstRun;		// per frame, per row: index of the first run
 	Surface* surface;
 };
 
@@ -9,53 +9,183 @@
 #define STBI_NO_PIC
 #define STBI_NO_PNM
 #include "lib/stb_image.h"
+#include <sys/stat.h>
 
 using namespace Tmpl8;
 
 // surface implementation
 // ----------------------------------------------------------------------------
 
-static char s_Font[51][5][6];
-static bool fontInitialized = false;
-static int s_Transl[256];
+// rows of allocated buffers are padded to a multiple of 16 pixels (64 bytes)
+static inline int PaddedPitch( const int w ) { return (w + 15) & ~15; }
 
-Surface::Surface( int w, int h, uint* b ) : pixels( b ), width( w ), height( h ) {}
-Surface::Surface( int w, int h ) : width( w ), height( h )
+Surface::Surface( int w, int h, uint* b ) : pixels( b ), width( w ), height( h ), pitch( w ) {}
+Surface::Surface( int w, int h ) : width( w ), height( h ), pitch( PaddedPitch( w ) )
 {
-	pixels = (uint*)MALLOC64( w * h * sizeof( uint ) );
+	pixels = (uint*)MALLOC64( pitch * h * sizeof( uint ) );
 	ownBuffer = true; // needs to be deleted in destructor
 }
+// view of the rectangle at (x, y) of size w x h of p, clipped to p
+Surface::Surface( Surface* p, int x, int y, int w, int h )
+{
+	const int x1 = clamp( x, 0, p->width ), y1 = clamp( y, 0, p->height );
+	width = clamp( x + w, 0, p->width ) - x1, height = clamp( y + h, 0, p->height ) - y1;
+	pitch = p->pitch, pixels = p->pixels + x1 + y1 * pitch;
+	// a view of a view refers to the owner directly
+	parent = p->parent ? p->parent : p, ox = p->ox + x1, oy = p->oy + y1;
+	trackDirty = p->trackDirty;
+}
 Surface::Surface( const char* file ) : pixels( 0 ), width( 0 ), height( 0 )
 {
-	FILE* f = fopen( file, "rb" );
-	if (!f) FatalError( "File not found: %s", file );
-	fclose( f );
 	Surface::LoadFromFile( file );
 }
 
+// stb_image output (grey, grey + alpha, RGB or RGBA bytes) to 0RGB pixels;
+// SSSE3 shuffles convert four pixels at a time.
+static void ConvertTo0RGB( uint* dst, const uchar* src, const int count, const int n )
+{
+	int i = 0;
+	if (CPUCaps::HW_SSSE3)
+	{
+		const char Z = -1; // zero byte
+		if (n == 1) // 4 bytes to 4 pixels
+		{
+			const __m128i shuffle = _mm_setr_epi8( 0, 0, 0, Z, 1, 1, 1, Z, 2, 2, 2, Z, 3, 3, 3, Z );
+			for (int v; i + 4 <= count; i += 4)
+				memcpy( &v, src + i, 4 ), _mm_storeu_si128( (__m128i*)(dst + i), _mm_shuffle_epi8( _mm_cvtsi32_si128( v ), shuffle ) );
+		}
+		else if (n == 2) // 8 bytes to 4 pixels
+		{
+			const __m128i shuffle = _mm_setr_epi8( 0, 0, 0, Z, 2, 2, 2, Z, 4, 4, 4, Z, 6, 6, 6, Z );
+			for (; i + 4 <= count; i += 4)
+				_mm_storeu_si128( (__m128i*)(dst + i), _mm_shuffle_epi8( _mm_loadl_epi64( (const __m128i*)(src + i * 2) ), shuffle ) );
+		}
+		else if (n == 3) // 12 of 16 loaded bytes to 4 pixels; stay 4 bytes clear of the end
+		{
+			const __m128i shuffle = _mm_setr_epi8( 2, 1, 0, Z, 5, 4, 3, Z, 8, 7, 6, Z, 11, 10, 9, Z );
+			for (; i + 6 <= count; i += 4)
+				_mm_storeu_si128( (__m128i*)(dst + i), _mm_shuffle_epi8( _mm_loadu_si128( (const __m128i*)(src + i * 3) ), shuffle ) );
+		}
+		else // 16 bytes to 4 pixels, alpha dropped
+		{
+			const __m128i shuffle = _mm_setr_epi8( 2, 1, 0, Z, 6, 5, 4, Z, 10, 9, 8, Z, 14, 13, 12, Z );
+			for (; i + 4 <= count; i += 4)
+				_mm_storeu_si128( (__m128i*)(dst + i), _mm_shuffle_epi8( _mm_loadu_si128( (const __m128i*)(src + i * 4) ), shuffle ) );
+		}
+	}
+	for (; i < count; i++)
+	{
+		const uchar* p = src + i * n;
+		dst[i] = n < 3 ? p[0] * 0x010101 : ((p[0] << 16) + (p[1] << 8) + p[2]);
+	}
+}
+
+// decoded images, keyed by path; an entry is reused as long as the file's
+// modification time does not change. Surfaces get their own copy. When the
+// cache exceeds its limit, the least recently used images are evicted.
+struct CachedImage { time_t mtime; int width, height; vector<uint> pixels; uint64_t used; };
+static unordered_map<string, CachedImage> imageCache;
+static size_t imageCacheBytes = 0, imageCacheLimit = 64 << 20;
+static uint64_t imageCacheClock = 0; // for the least recently used
+static mutex imageCacheLock;
+
+// make room for 'bytes' more; with imageCacheLock held
+static void EvictImages( const size_t bytes )
+{
+	while (!imageCache.empty() && imageCacheBytes + bytes > imageCacheLimit)
+	{
+		auto oldest = imageCache.begin();
+		for (auto it = imageCache.begin(); it != imageCache.end(); ++it) if (it->second.used < oldest->second.used) oldest = it;
+		imageCacheBytes -= oldest->second.pixels.size() * sizeof( uint );
+		imageCache.erase( oldest );
+	}
+}
+
 void Surface::LoadFromFile( const char* file )
 {
+	struct stat s;
+	if (stat( file, &s )) FatalError( "File not found: %s", file );
+	Decode( file, s.st_mtime ); // a file that is no image leaves the surface empty
+}
+
+// decode 'file', or copy it from the cache if it did not change since;
+// false if it could not be decoded
+bool Surface::Decode( const char* file, const time_t mtime )
+{
+	{
+		lock_guard<mutex> lock( imageCacheLock );
+		auto it = imageCache.find( file );
+		if (it != imageCache.end() && it->second.mtime == mtime)
+		{
+			width = it->second.width, height = it->second.height, pitch = PaddedPitch( width );
+			pixels = (uint*)MALLOC64( pitch * height * sizeof( uint ) );
+			ownBuffer = true; // needs to be deleted in destructor
+			for (int y = 0; y < height; y++) memcpy( pixels + y * pitch, it->second.pixels.data() + y * width, width * sizeof( uint ) );
+			it->second.used = ++imageCacheClock;
+			return true;
+		}
+	}
 	int n;
 	unsigned char* data = stbi_load( file, &width, &height, &n, 0 );
 	if (data)
 	{
-		pixels = (uint*)MALLOC64( width * height * sizeof( uint ) );
+		pitch = PaddedPitch( width );
+		pixels = (uint*)MALLOC64( pitch * height * sizeof( uint ) );
 		ownBuffer = true; // needs to be deleted in destructor
-		const int s = width * height;
-		if (n == 1) // greyscale
+		for (int y = 0; y < height; y++) ConvertTo0RGB( pixels + y * pitch, data + y * width * n, width, n );
+		lock_guard<mutex> lock( imageCacheLock );
+		auto it = imageCache.find( file );
+		if (it != imageCache.end()) imageCacheBytes -= it->second.pixels.size() * sizeof( uint ), imageCache.erase( it ); // stale
+		const size_t bytes = (size_t)width * height * sizeof( uint );
+		if (bytes <= imageCacheLimit)
 		{
-			for (int i = 0; i < s; i++)
-			{
-				const unsigned char p = data[i];
-				pixels[i] = p + (p << 8) + (p << 16);
-			}
-		}
-		else
-		{
-			for (int i = 0; i < s; i++) pixels[i] = (data[i * n + 0] << 16) + (data[i * n + 1] << 8) + data[i * n + 2];
+			EvictImages( bytes );
+			CachedImage& entry = imageCache[file];
+			entry.mtime = mtime, entry.width = width, entry.height = height, entry.used = ++imageCacheClock;
+			entry.pixels.resize( width * height );
+			for (int y = 0; y < height; y++) memcpy( entry.pixels.data() + y * width, pixels + y * pitch, width * sizeof( uint ) );
+			imageCacheBytes += bytes;
 		}
 	}
 	stbi_image_free( data );
+	return data != 0;
+}
+
+void Surface::FlushImageCache()
+{
+	lock_guard<mutex> lock( imageCacheLock );
+	imageCache.clear();
+	imageCacheBytes = 0;
+}
+
+void Surface::SetImageCacheLimit( const size_t bytes )
+{
+	lock_guard<mutex> lock( imageCacheLock );
+	imageCacheLimit = bytes;
+	EvictImages( 0 );
+}
+
+// load a batch of images, one job per file. Files that cannot be loaded
+// are collected, and reported together once all jobs completed, from the
+// calling thread.
+void Surface::LoadBatch( const char** files, Surface** result, const int count )
+{
+	vector<char> failed( max( 0, count ), 0 ); // 1: not found, 2: no image
+	ParallelFor( 0, count, 1, [&]( const int i )
+	{
+		struct stat s;
+		result[i] = new Surface( 0, 0, (uint*)0 );
+		if (stat( files[i], &s )) failed[i] = 1;
+		else if (!result[i]->Decode( files[i], s.st_mtime )) failed[i] = 2;
+	} );
+	string report;
+	int errors = 0;
+	for (int i = 0; i < count; i++) if (failed[i])
+	{
+		if (errors++ < 10) report += string( "\n" ) + files[i] + (failed[i] == 1 ? ": file not found" : ": not an image");
+		else if (errors == 11) report += "\n...";
+	}
+	if (errors) FatalError( "LoadBatch: %i of %i files could not be loaded:%s", errors, count, report.c_str() );
 }
 
 Surface::~Surface()
@@ -63,16 +193,131 @@ Surface::~Surface()
 	if (ownBuffer) FREE64( pixels ); // free only if we allocated the buffer ourselves
 }
 
+// fill n pixels: scalar up to a 32-byte boundary, then aligned AVX stores
+static inline void Fill( uint* a, int n, const uint c )
+{
+	if (CPUCaps::HW_AVX && n >= 16)
+	{
+		for (; ((size_t)a & 31) != 0; n--) *a++ = c;
+		const __m256i c8 = _mm256_set1_epi32( c );
+		for (; n >= 8; n -= 8, a += 8) _mm256_store_si256( (__m256i*)a, c8 );
+	}
+	while (n-- > 0) *a++ = c;
+}
+
+// empty dirty rectangle; the union with any rectangle is that rectangle
+static const int4 noDirt( 0x7fffffff, 0x7fffffff, -1, -1 );
+static inline int4 Union( const int4& a, const int4& b )
+{
+	return int4( min( a.x, b.x ), min( a.y, b.y ), max( a.z, b.z ), max( a.w, b.w ) );
+}
+
+void Surface::TrackDirty( bool enable )
+{
+	// contents are unknown: everything needs a clear and an upload
+	trackDirty = enable;
+	dirty = changed = int4( 0, 0, width - 1, height - 1 );
+}
+
+// conservative dirty region for lines between count points, stride bytes
+// apart. Truncated clipped coordinates stay inside the bounds of the
+// finite input coordinates; fminf / fmaxf ignore NaNs.
+void Surface::MarkDirty( const float2* p, const int count, const int stride )
+{
+	if (!trackDirty || count <= 0) return;
+	float x1 = 1e30f, y1 = 1e30f, x2 = -1e30f, y2 = -1e30f;
+	for (int i = 0; i < count; i++, p = (const float2*)((const char*)p + stride))
+		x1 = fminf( x1, p->x ), y1 = fminf( y1, p->y ), x2 = fmaxf( x2, p->x ), y2 = fmaxf( y2, p->y );
+	const float w = (float)width, h = (float)height;
+	MarkDirty( (int)clamp( x1, -1.0f, w ), (int)clamp( y1, -1.0f, h ), (int)clamp( x2, -1.0f, w ), (int)clamp( y2, -1.0f, h ) );
+}
+
+// region that changed since the previous call: cleared and drawn pixels
+int4 Surface::TakeChanged()
+{
+	const int4 r = Union( changed, dirty );
+	changed = noDirt;
+	return r;
+}
+
+// clears of buffers this large stream past the cache; smaller ones are
+// usually drawn to right after, and are faster to keep cached.
+#define STREAMING_CLEAR	(8 * 1024 * 1024)
+
+// large fills are split over the job system in blocks of about this many
+// pixels; for smaller ones, waking the workers costs more than it saves.
+#define FILL_BLOCK	(64 * 1024)
+
+// f( first, n ) for consecutive blocks of a span of n pixels
+template <class F> static void ForBlocks( const int n, F&& f )
+{
+	ParallelFor( 0, (n + FILL_BLOCK - 1) / FILL_BLOCK, 1, [&]( const int i ) { f( i * FILL_BLOCK, min( FILL_BLOCK, n - i * FILL_BLOCK ) ); } );
+}
+
+// f( y ) for rows y0..y1-1 of w pixels each
+template <class F> static void ForRows( const int y0, const int y1, const int w, F&& f )
+{
+	ParallelFor( y0, y1, max( 1, FILL_BLOCK / max( 1, w ) ), f );
+}
+
 void Surface::Clear( uint c )
 {
-	const int s = width * height;
-	for (int i = 0; i < s; i++) pixels[i] = c;
+	if (parent)
+	{
+		// views clear row by row; the owner keeps track of what changed
+		ForRows( 0, height, width, [&]( const int y ) { Fill( pixels + y * pitch, width, c ); } );
+		MarkDirty( 0, 0, width - 1, height - 1 );
+		return;
+	}
+	// the rows of a buffer we own are contiguous, padding included
+	if (pitch * height >= STREAMING_CLEAR) ClearStreaming( c );
+	else ForBlocks( pitch * height, [&]( const int first, const int n ) { Fill( pixels + first, n, c ); } );
+	if (trackDirty) changed = int4( 0, 0, width - 1, height - 1 ), dirty = noDirt, clearColor = c;
+}
+
+// clear only what was drawn since the previous clear to the same color
+void Surface::ClearDirty( uint c )
+{
+	if (parent || !trackDirty || c != clearColor) { Clear( c ); return; }
+	if (dirty.x <= dirty.z) ForRows( dirty.y, dirty.w + 1, dirty.z - dirty.x + 1, [&]( const int y ) { Fill( pixels + dirty.x + y * pitch, dirty.z - dirty.x + 1, c ); } );
+	changed = Union( changed, dirty ), dirty = noDirt;
+}
+
+// fill n pixels with non-temporal stores
+static inline void Stream( uint* a, int n, const uint c )
+{
+	if (CPUCaps::HW_AVX)
+	{
+		for (; n > 0 && ((size_t)a & 31) != 0; n--) *a++ = c;
+		const __m256i c8 = _mm256_set1_epi32( c );
+		for (; n >= 32; n -= 32, a += 32)
+		{
+			_mm256_stream_si256( (__m256i*)a, c8 );
+			_mm256_stream_si256( (__m256i*)(a + 8), c8 );
+			_mm256_stream_si256( (__m256i*)(a + 16), c8 );
+			_mm256_stream_si256( (__m256i*)(a + 24), c8 );
+		}
+		for (; n >= 8; n -= 8, a += 8) _mm256_stream_si256( (__m256i*)a, c8 );
+	}
+	while (n-- > 0) *a++ = c;
+}
+
+// clear with non-temporal stores: the buffer is written without reading it
+// into the cache first, and without evicting other data.
+void Surface::ClearStreaming( uint c )
+{
+	// every thread orders its own streaming stores before later drawing
+	if (parent) ForRows( 0, height, width, [&]( const int y ) { Stream( pixels + y * pitch, width, c ); _mm_sfence(); } );
+	else ForBlocks( pitch * height, [&]( const int first, const int n ) { Stream( pixels + first, n, c ); _mm_sfence(); } );
+	if (parent) MarkDirty( 0, 0, width - 1, height - 1 );
+	else if (trackDirty) changed = int4( 0, 0, width - 1, height - 1 ), dirty = noDirt, clearColor = c;
 }
 
 void Surface::Plot( int x, int y, uint c )
 {
 	if (x < 0 || y < 0 || x >= width || y >= height) return;
-	pixels[x + y * width] = c;
+	pixels[x + y * pitch] = c;
+	MarkDirty( x, y, x, y );
 }
 
 void Surface::Box( int x1, int y1, int x2, int y2, uint c )
@@ -89,57 +334,468 @@ void Surface::Bar( int x1, int y1, int x2, int y2, uint c )
 	if (x1 < 0) x1 = 0;
 	if (x2 >= width) x2 = width - 1;
 	if (y1 < 0) y1 = 0;
-	if (y2 >= height) y2 = width - 1;
+	if (y2 >= height) y2 = height - 1;
+	if (x2 < x1 || y2 < y1) return;
+	MarkDirty( x1, y1, x2, y2 );
 	// draw clipped bar
-	uint* a = x1 + y1 * width + pixels;
-	for (int y = y1; y <= y2; y++)
+	uint* a = x1 + y1 * pitch + pixels;
+	for (int y = y1; y <= y2; y++, a += pitch) Fill( a, x2 - x1 + 1, c );
+}
+
+// 5x5 font, baked at compile time: per character, five rows of 5-bit masks
+// (bit h is column h). Upper case uses the lower case glyphs; characters
+// without a glyph are blank.
+static constexpr uchar FontRow( const char* r )
+{
+	uchar m = 0;
+	for (int h = 0; h < 5; h++) if (r[h] == 'o') m |= 1 << h;
+	return m;
+}
+struct Font { uchar glyph[256][5]; };
+static constexpr Font BakeFont()
+{
+	const char* chars = "abcdefghijklmnopqrstuvwxyz0123456789!?:=,.-() #'*/";
+	const char* rows[50][5] = {
+		{ ":ooo:", "o:::o", "ooooo", "o:::o", "o:::o" },
+		{ "oooo:", "o:::o", "oooo:", "o:::o", "oooo:" },
+		{ ":oooo", "o::::", "o::::", "o::::", ":oooo" },
+		{ "oooo:", "o:::o", "o:::o", "o:::o", "oooo:" },
+		{ "ooooo", "o::::", "oooo:", "o::::", "ooooo" },
+		{ "ooooo", "o::::", "ooo::", "o::::", "o::::" },
+		{ ":oooo", "o::::", "o:ooo", "o:::o", ":ooo:" },
+		{ "o:::o", "o:::o", "ooooo", "o:::o", "o:::o" },
+		{ "::o::", "::o::", "::o::", "::o::", "::o::" },
+		{ ":::o:", ":::o:", ":::o:", ":::o:", "ooo::" },
+		{ "o::o:", "o:o::", "oo:::", "o:o::", "o::o:" },
+		{ "o::::", "o::::", "o::::", "o::::", "ooooo" },
+		{ "oo:o:", "o:o:o", "o:o:o", "o:::o", "o:::o" },
+		{ "o:::o", "oo::o", "o:o:o", "o::oo", "o:::o" },
+		{ ":ooo:", "o:::o", "o:::o", "o:::o", ":ooo:" },
+		{ "oooo:", "o:::o", "oooo:", "o::::", "o::::" },
+		{ ":ooo:", "o:::o", "o:::o", "o::oo", ":oooo" },
+		{ "oooo:", "o:::o", "oooo:", "o:o::", "o::o:" },
+		{ ":oooo", "o::::", ":ooo:", "::::o", "oooo:" },
+		{ "ooooo", "::o::", "::o::", "::o::", "::o::" },
+		{ "o:::o", "o:::o", "o:::o", "o:::o", ":oooo" },
+		{ "o:::o", "o:::o", ":o:o:", ":o:o:", "::o::" },
+		{ "o:::o", "o:::o", "o:o:o", "o:o:o", ":o:o:" },
+		{ "o:::o", ":o:o:", "::o::", ":o:o:", "o:::o" },
+		{ "o:::o", "o:::o", ":oooo", "::::o", ":ooo:" },
+		{ "ooooo", ":::o:", "::o::", ":o:::", "ooooo" },
+		{ ":ooo:", "o::oo", "o:o:o", "oo::o", ":ooo:" },
+		{ "::o::", ":oo::", "::o::", "::o::", ":ooo:" },
+		{ ":ooo:", "o:::o", "::oo:", ":o:::", "ooooo" },
+		{ "oooo:", "::::o", "::oo:", "::::o", "oooo:" },
+		{ "o::::", "o::o:", "ooooo", ":::o:", ":::o:" },
+		{ "ooooo", "o::::", "oooo:", "::::o", "oooo:" },
+		{ ":oooo", "o::::", "oooo:", "o:::o", ":ooo:" },
+		{ "ooooo", "::::o", ":::o:", "::o::", "::o::" },
+		{ ":ooo:", "o:::o", ":ooo:", "o:::o", ":ooo:" },
+		{ ":ooo:", "o:::o", ":oooo", "::::o", ":ooo:" },
+		{ "::o::", "::o::", "::o::", ":::::", "::o::" },
+		{ ":ooo:", "::::o", ":::o:", ":::::", "::o::" },
+		{ ":::::", ":::::", "::o::", ":::::", "::o::" },
+		{ ":::::", ":::::", ":ooo:", ":::::", ":ooo:" },
+		{ ":::::", ":::::", ":::::", ":::o:", "::o::" },
+		{ ":::::", ":::::", ":::::", ":::::", "::o::" },
+		{ ":::::", ":::::", ":ooo:", ":::::", ":::::" },
+		{ ":::o:", "::o::", "::o::", "::o::", ":::o:" },
+		{ "::o::", ":::o:", ":::o:", ":::o:", "::o::" },
+		{ ":::::", ":::::", ":::::", ":::::", ":::::" },
+		{ "ooooo", "ooooo", "ooooo", "ooooo", "ooooo" },
+		{ "::o::", "::o::", ":::::", ":::::", ":::::" }, // Tnx Ferry
+		{ "o:o:o", ":ooo:", "ooooo", ":ooo:", "o:o:o" },
+		{ "::::o", ":::o:", "::o::", ":o:::", "o::::" }
+	};
+	Font f = {};
+	for (int i = 0; i < 50; i++) for (int v = 0; v < 5; v++)
 	{
-		for (int x = 0; x <= (x2 - x1); x++) a[x] = c;
-		a += width;
+		const uchar c = (uchar)chars[i], m = FontRow( rows[i][v] );
+		f.glyph[c][v] = m;
+		if (c >= 'a' && c <= 'z') f.glyph[c - 'a' + 'A'][v] = m;
 	}
+	return f;
 }
+static constexpr Font font = BakeFont();
 
-void Surface::Print( const char* s, int x1, int y1, uint c )
+// one character at a: the glyph rows in color c, and a black shadow one
+// pixel below every glyph pixel that the glyph does not cover itself. Each
+// of the six rows is a single masked store.
+static inline void DrawGlyph( uint* a, const int pitch, const uchar* g, const uint c )
 {
-	if (!fontInitialized)
+	if (CPUCaps::HW_AVX2)
 	{
-		InitCharset();
-		fontInitialized = true;
+		const __m256i bits = _mm256_setr_epi32( 1, 2, 4, 8, 16, 32, 64, 128 ), c8 = _mm256_set1_epi32( c );
+		for (int v = 0, above = 0; v < 6; v++, a += pitch)
+		{
+			const int m = v < 5 ? g[v] : 0, w = m | above;
+			above = m;
+			if (!w) continue;
+			const __m256i on = _mm256_cmpeq_epi32( _mm256_and_si256( _mm256_set1_epi32( m ), bits ), bits );
+			const __m256i write = _mm256_cmpeq_epi32( _mm256_and_si256( _mm256_set1_epi32( w ), bits ), bits );
+			_mm256_maskstore_epi32( (int*)a, write, _mm256_and_si256( on, c8 ) );
+		}
+		return;
 	}
-	uint* t = pixels + x1 + y1 * width;
-	for (int i = 0; i < (int)(strlen( s )); i++, t += 6)
+	for (int v = 0, above = 0; v < 6; v++, a += pitch)
 	{
-		int pos = 0;
-		if ((s[i] >= 'A') && (s[i] <= 'Z')) pos = s_Transl[(unsigned short)(s[i] - ('A' - 'a'))];
-		else pos = s_Transl[(unsigned short)s[i]];
-		uint* a = t;
-		const char* u = (const char*)s_Font[pos];
-		for (int v = 0; v < 5; v++, u++, a += width)
-			for (int h = 0; h < 5; h++) if (*u++ == 'o') *(a + h) = c, * (a + h + width) = 0;
+		const int m = v < 5 ? g[v] : 0, w = m | above;
+		above = m;
+		for (int h = 0; h < 5; h++) if ((w >> h) & 1) a[h] = ((m >> h) & 1) ? c : 0;
+	}
+}
+
+// text in the 5x5 font, characters 6 pixels apart; a newline continues 10
+// pixels down, so a block of lines is a single call. Characters that do not
+// fit on the surface entirely are skipped.
+void Surface::Print( const char* s, int x1, int y1, uint c )
+{
+	for (int x = x1;; s++)
+	{
+		if (*s == '\n' || *s == 0)
+		{
+			MarkDirty( x1, y1, x - 1, y1 + 5 );
+			if (*s == 0) return;
+			x = x1, y1 += 10;
+			continue;
+		}
+		const uchar* g = font.glyph[(uchar)*s];
+		if ((g[0] | g[1] | g[2] | g[3] | g[4]) && x >= 0 && y1 >= 0 && x + 5 <= width && y1 + 6 <= height)
+			DrawGlyph( pixels + x + y1 * pitch, pitch, g, c );
+		x += 6;
 	}
 }
 
 #define OUTCODE(x,y) (((x)<xmin)?1:(((x)>xmax)?2:0))+(((y)<ymin)?4:(((y)>ymax)?8:0))
 
+// clip a segment to the surface; returns false if nothing remains.
+bool Surface::ClipLine( float& x1, float& y1, float& x2, float& y2 ) const
+{
+	// reject non-finite coordinates; exploding vertices produce these
+	if (!(isfinite( x1 ) && isfinite( y1 ) && isfinite( x2 ) && isfinite( y2 ))) return false;
+	// Cohen-Sutherland clipping against the surface
+	const float xmin = 0, ymin = 0, xmax = (float)(width - 1), ymax = (float)(height - 1);
+	int c1 = OUTCODE( x1, y1 ), c2 = OUTCODE( x2, y2 );
+	if (c1 | c2)
+	{
+		// each endpoint needs at most two clips
+		for (int i = 0; i < 4 && (c1 | c2); i++)
+		{
+			if (c1 & c2) return false; // fully outside
+			const int code = c1 ? c1 : c2;
+			float x, y;
+			if (code & 8) x = x1 + (x2 - x1) * (ymax - y1) / (y2 - y1), y = ymax;
+			else if (code & 4) x = x1 + (x2 - x1) * (ymin - y1) / (y2 - y1), y = ymin;
+			else if (code & 2) y = y1 + (y2 - y1) * (xmax - x1) / (x2 - x1), x = xmax;
+			else y = y1 + (y2 - y1) * (xmin - x1) / (x2 - x1), x = xmin;
+			if (code == c1) x1 = x, y1 = y, c1 = OUTCODE( x1, y1 );
+			else x2 = x, y2 = y, c2 = OUTCODE( x2, y2 );
+		}
+		if (c1 & c2) return false;
+		// absorb floating point round-off at the edges
+		x1 = clamp( x1, xmin, xmax ), y1 = clamp( y1, ymin, ymax );
+		x2 = clamp( x2, xmin, xmax ), y2 = clamp( y2, ymin, ymax );
+	}
+	return true;
+}
+
 void Surface::Line( float x1, float y1, float x2, float y2, uint c )
 {
-	if (!(x1 >= 0 && x1 <= (SCRWIDTH - 1) && y1 >= 0 && y1 <= (SCRHEIGHT - 1) && 
-		  x2 >= 0 && x2 <= (SCRWIDTH - 1) && y2 >= 0 && y2 <= SCRHEIGHT - 1)) return;
-	float b = x2 - x1;
-	float h = y2 - y1;
-	float l = fabsf( b );
-	if (fabsf( h ) > l) l = fabsf( h );
-	int il = (int)l;
-	float dx = b / (float)l;
-	float dy = h / (float)l;
-	for (int i = 0; i <= il; i++)
+	if (ClipLine( x1, y1, x2, y2 )) LineNoClip( (int)x1, (int)y1, (int)x2, (int)y2, c );
+}
+
+// Bresenham inner loop, shared by all line entry points so they produce
+// identical pixels. n: major axis length, d: minor axis length, major/minor:
+// pointer increments for a step along each axis. The minor step is
+// branchless: per pixel, one store, one pointer add and an error update.
+// BresenhamRun draws count pixels starting with error term err, so a line
+// can be resumed at any pixel; plot can replace the plain store.
+template <class P> static inline void BresenhamRun( uint* a, const int count, int err, const int n, const int d, const int major, const int minor, const P& plot )
+{
+	for (int i = 0; i < count; i++)
+	{
+		plot( a ), err -= d;
+		const int m = err >> 31; // all ones if the minor axis steps
+		a += major + (m & minor), err += m & n;
+	}
+}
+static inline void BresenhamRun( uint* a, const int count, int err, const int n, const int d, const int major, const int minor, const uint c )
+{
+	BresenhamRun( a, count, err, n, d, major, minor, [c]( uint* p ) { *p = c; } );
+}
+static inline void Bresenham( uint* a, const int n, const int d, const int major, const int minor, const uint c )
+{
+	BresenhamRun( a, n + 1, n >> 1, n, d, major, minor, c );
+}
+
+// additive line: same pixels as Line, saturating add instead of a store
+void Surface::AddLine( float x1, float y1, float x2, float y2, uint c )
+{
+	if (!ClipLine( x1, y1, x2, y2 )) return;
+	const int ix1 = (int)x1, iy1 = (int)y1, ix2 = (int)x2, iy2 = (int)y2;
+	MarkDirty( min( ix1, ix2 ), min( iy1, iy2 ), max( ix1, ix2 ), max( iy1, iy2 ) );
+	const int dx = ix2 - ix1, dy = iy2 - iy1, adx = abs( dx ), ady = abs( dy );
+	const int sx = dx < 0 ? -1 : 1, sy = dy < 0 ? -pitch : pitch;
+	const auto plot = [c]( uint* p ) { *p = AddBlend( *p, c ); };
+	uint* a = pixels + ix1 + iy1 * pitch;
+	if (adx >= ady) BresenhamRun( a, adx + 1, adx >> 1, adx, ady, sx, sy, plot );
+	else BresenhamRun( a, ady + 1, ady >> 1, ady, adx, sy, sx, plot );
+}
+
+// integer line; both endpoints must be on the surface.
+void Surface::LineNoClip( int x1, int y1, int x2, int y2, uint c )
+{
+	if (trackDirty) MarkDirty( min( x1, x2 ), min( y1, y2 ), max( x1, x2 ), max( y1, y2 ) );
+	const int dx = x2 - x1, dy = y2 - y1;
+	const int sx = dx < 0 ? -1 : 1, sy = dy < 0 ? -pitch : pitch;
+	const int adx = abs( dx ), ady = abs( dy );
+	uint* a = pixels + x1 + y1 * pitch;
+	if (adx >= ady) Bresenham( a, adx, ady, sx, sy, c ); else Bresenham( a, ady, adx, sy, sx, c );
+}
+
+// integer line restricted to the rectangle [rx1, rx2] x [ry1, ry2]; both
+// endpoints must be on the surface. Does not mark the line dirty, so it can
+// be used from several threads on disjoint rectangles. Draws exactly the pixels of LineNoClip
+// that fall inside the rectangle: after i steps along the major axis, the
+// minor axis has stepped k = ceil((i * d - h) / n) times, with h = n / 2, so
+// the first and last pixel inside the rectangle follow in closed form.
+void Surface::LineInRect( int x1, int y1, int x2, int y2, uint c, int rx1, int ry1, int rx2, int ry2 )
+{
+	// short lines are usually fully inside
+	if (min( x1, x2 ) >= rx1 && max( x1, x2 ) <= rx2 && min( y1, y2 ) >= ry1 && max( y1, y2 ) <= ry2)
+	{
+		const int dx = x2 - x1, dy = y2 - y1, adx = abs( dx ), ady = abs( dy );
+		const int sx = dx < 0 ? -1 : 1, sy = dy < 0 ? -pitch : pitch;
+		if (adx >= ady) Bresenham( pixels + x1 + y1 * pitch, adx, ady, sx, sy, c ); else Bresenham( pixels + x1 + y1 * pitch, ady, adx, sy, sx, c );
+		return;
+	}
+	const int dx = x2 - x1, dy = y2 - y1, sx = dx < 0 ? -1 : 1, sy = dy < 0 ? -1 : 1;
+	const int adx = abs( dx ), ady = abs( dy );
+	const bool xmajor = adx >= ady;
+	const int n = xmajor ? adx : ady, d = xmajor ? ady : adx, h = n >> 1;
+	// major and minor axis: start, direction and rectangle extents
+	const int M = xmajor ? x1 : y1, sM = xmajor ? sx : sy, A0 = xmajor ? rx1 : ry1, A1 = xmajor ? rx2 : ry2;
+	const int m = xmajor ? y1 : x1, sm = xmajor ? sy : sx, B0 = xmajor ? ry1 : rx1, B1 = xmajor ? ry2 : rx2;
+	// step range from the major axis
+	int i0 = max( 0, sM > 0 ? A0 - M : M - A1 ), i1 = min( n, sM > 0 ? A1 - M : M - A0 );
+	// step range from the minor axis: kmin <= k <= kmax, with k non-decreasing
+	const int kmin = sm > 0 ? B0 - m : m - B1, kmax = sm > 0 ? B1 - m : m - B0;
+	if (kmax < 0 || (d == 0 && kmin > 0)) return;
+	// divisions only where the minor axis range actually cuts the line
+	if (kmin > 0) i0 = max( i0, ((kmin - 1) * n + h) / d + 1 );
+	if (kmax < d) i1 = min( i1, (kmax * n + h) / d );
+	if (i0 > i1) return;
+	const int k = i0 == 0 ? 0 : (i0 * d - h + n - 1) / n;
+	const int px = xmajor ? x1 + sx * i0 : x1 + sx * k, py = xmajor ? y1 + sy * k : y1 + sy * i0;
+	const int major = xmajor ? sx : sy * pitch, minor = xmajor ? sy * pitch : sx;
+	BresenhamRun( pixels + px + py * pitch, i1 - i0 + 1, h - i0 * d + k * n, n, d, major, minor, c );
+}
+
+// load 8 float2's and split them in x and y registers
+static inline void Deinterleave8( const float2* p, __m256& x, __m256& y )
+{
+	const __m256 lo = _mm256_loadu_ps( (const float*)p ), hi = _mm256_loadu_ps( (const float*)(p + 4) );
+	// shuffle yields elements 0,1,4,5,2,3,6,7; a 64-bit permute restores the order
+	x = _mm256_castpd_ps( _mm256_permute4x64_pd( _mm256_castps_pd( _mm256_shuffle_ps( lo, hi, _MM_SHUFFLE( 2, 0, 2, 0 ) ) ), _MM_SHUFFLE( 3, 1, 2, 0 ) ) );
+	y = _mm256_castpd_ps( _mm256_permute4x64_pd( _mm256_castps_pd( _mm256_shuffle_ps( lo, hi, _MM_SHUFFLE( 3, 1, 3, 1 ) ) ), _MM_SHUFFLE( 3, 1, 2, 0 ) ) );
+}
+
+// Bresenham setup for 8 integer segments, stored for the scalar loop:
+// start offset, major/minor axis lengths and pointer steps.
+struct ALIGN( 32 ) LineSetup8 { int offset[8], n[8], d[8], major[8], minor[8]; };
+static inline void Setup8( const __m256i x1, const __m256i y1, const __m256i x2, const __m256i y2, const int pitch, LineSetup8& s )
+{
+	const __m256i one8 = _mm256_set1_epi32( 1 ), pitch8 = _mm256_set1_epi32( pitch );
+	const __m256i dx = _mm256_sub_epi32( x2, x1 ), dy = _mm256_sub_epi32( y2, y1 );
+	const __m256i adx = _mm256_abs_epi32( dx ), ady = _mm256_abs_epi32( dy );
+	const __m256i sx = _mm256_or_si256( _mm256_srai_epi32( dx, 31 ), one8 ); // -1 or 1
+	const __m256i sy = _mm256_mullo_epi32( _mm256_or_si256( _mm256_srai_epi32( dy, 31 ), one8 ), pitch8 );
+	const __m256i ymajor = _mm256_cmpgt_epi32( ady, adx );
+	_mm256_store_si256( (__m256i*)s.offset, _mm256_add_epi32( x1, _mm256_mullo_epi32( y1, pitch8 ) ) );
+	_mm256_store_si256( (__m256i*)s.n, _mm256_max_epi32( adx, ady ) );
+	_mm256_store_si256( (__m256i*)s.d, _mm256_min_epi32( adx, ady ) );
+	_mm256_store_si256( (__m256i*)s.major, _mm256_blendv_epi8( sx, sy, ymajor ) );
+	_mm256_store_si256( (__m256i*)s.minor, _mm256_blendv_epi8( sy, sx, ymajor ) );
+}
+
+// AVX2 line setup for 8 segments at a time: trivial accept test and integer
+// endpoints. Accepted segments go straight to the Bresenham loop; the rest
+// take the clipping path. Returns the number of segments processed (a
+// multiple of 8).
+static int LinesAVX2( Surface* s, const float2* a, const float2* b, const int count, const uint c )
+{
+	const __m256 zero8 = _mm256_setzero_ps();
+	const __m256 xmax8 = _mm256_set1_ps( (float)(s->width - 1) ), ymax8 = _mm256_set1_ps( (float)(s->height - 1) );
+	LineSetup8 setup;
+	int i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		__m256 x1f, y1f, x2f, y2f;
+		Deinterleave8( a + i, x1f, y1f );
+		Deinterleave8( b + i, x2f, y2f );
+		// both endpoints on the surface; ordered compares also reject NaNs
+		const __m256 in1 = _mm256_and_ps( _mm256_and_ps( _mm256_cmp_ps( x1f, zero8, _CMP_GE_OQ ), _mm256_cmp_ps( x1f, xmax8, _CMP_LE_OQ ) ),
+			_mm256_and_ps( _mm256_cmp_ps( y1f, zero8, _CMP_GE_OQ ), _mm256_cmp_ps( y1f, ymax8, _CMP_LE_OQ ) ) );
+		const __m256 in2 = _mm256_and_ps( _mm256_and_ps( _mm256_cmp_ps( x2f, zero8, _CMP_GE_OQ ), _mm256_cmp_ps( x2f, xmax8, _CMP_LE_OQ ) ),
+			_mm256_and_ps( _mm256_cmp_ps( y2f, zero8, _CMP_GE_OQ ), _mm256_cmp_ps( y2f, ymax8, _CMP_LE_OQ ) ) );
+		const int accept = _mm256_movemask_ps( _mm256_and_ps( in1, in2 ) );
+		// same truncation as the scalar path
+		if (accept) Setup8( _mm256_cvttps_epi32( x1f ), _mm256_cvttps_epi32( y1f ),
+			_mm256_cvttps_epi32( x2f ), _mm256_cvttps_epi32( y2f ), s->pitch, setup );
+		for (int j = 0; j < 8; j++)
+		{
+			if (accept & (1 << j)) Bresenham( s->pixels + setup.offset[j], setup.n[j], setup.d[j], setup.major[j], setup.minor[j], c );
+			else s->Line( a[i + j].x, a[i + j].y, b[i + j].x, b[i + j].y, c );
+		}
+	}
+	return i;
+}
+
+// batched lines: segment i runs from a[i] to b[i]
+void Surface::Lines( const float2* a, const float2* b, const int count, uint c )
+{
+	MarkDirty( a, count, sizeof( float2 ) ), MarkDirty( b, count, sizeof( float2 ) );
+	int i = 0;
+	if (CPUCaps::HW_AVX2) i = LinesAVX2( this, a, b, count, c );
+	for (; i < count; i++) Line( a[i].x, a[i].y, b[i].x, b[i].y, c );
+}
+
+// wireframe of a structured grid of columns x rows vertices. Vertex (x, y)
+// is at (char*)pos + x * stride + y * rowStride, so positions can be read from
+// a larger struct. Every vertex is converted to integer screen coordinates
+// once; edges between two on-screen vertices are then set up eight at a
+// time from that buffer. Edges with an off-screen vertex are clipped by
+// Line, so the result is identical to drawing each edge with Line.
+void Surface::Grid( const float2* pos, const int stride, const int rowStride, const int columns, const int rows, uint c )
+{
+	if (columns < 1 || rows < 1) return;
+	thread_local vector<int> gx, gy; // per thread: Grid may run in jobs; x is -1 for vertices that are not on the surface
+	gx.resize( columns * rows ), gy.resize( columns * rows );
+	auto P = [&]( const int x, const int y ) -> const float2& { return *(const float2*)((const char*)pos + x * stride + y * rowStride); };
+	if (trackDirty) for (int y = 0; y < rows; y++) MarkDirty( &P( 0, y ), columns, stride );
+	// vertex pass
+	const float xmax = (float)(width - 1), ymax = (float)(height - 1);
+	for (int y = 0; y < rows; y++)
+	{
+		int* rx = gx.data() + y * columns, * ry = gy.data() + y * columns, x = 0;
+		if (CPUCaps::HW_AVX2 && (stride & 3) == 0)
+		{
+			const __m256 zero8 = _mm256_setzero_ps(), xmax8 = _mm256_set1_ps( xmax ), ymax8 = _mm256_set1_ps( ymax );
+			const __m256i idx = _mm256_mullo_epi32( _mm256_setr_epi32( 0, 1, 2, 3, 4, 5, 6, 7 ), _mm256_set1_epi32( stride >> 2 ) );
+			for (; x + 8 <= columns; x += 8)
+			{
+				const float* p = (const float*)&P( x, y );
+				const __m256 xf = _mm256_i32gather_ps( p, idx, 4 ), yf = _mm256_i32gather_ps( p + 1, idx, 4 );
+				const __m256 in = _mm256_and_ps( _mm256_and_ps( _mm256_cmp_ps( xf, zero8, _CMP_GE_OQ ), _mm256_cmp_ps( xf, xmax8, _CMP_LE_OQ ) ),
+					_mm256_and_ps( _mm256_cmp_ps( yf, zero8, _CMP_GE_OQ ), _mm256_cmp_ps( yf, ymax8, _CMP_LE_OQ ) ) );
+				_mm256_storeu_si256( (__m256i*)(rx + x), _mm256_blendv_epi8( _mm256_set1_epi32( -1 ), _mm256_cvttps_epi32( xf ), _mm256_castps_si256( in ) ) );
+				_mm256_storeu_si256( (__m256i*)(ry + x), _mm256_cvttps_epi32( yf ) );
+			}
+		}
+		for (; x < columns; x++)
+		{
+			const float2& p = P( x, y );
+			const bool in = p.x >= 0 && p.x <= xmax && p.y >= 0 && p.y <= ymax;
+			rx[x] = in ? (int)p.x : -1, ry[x] = in ? (int)p.y : 0;
+		}
+	}
+	// edge pass: count edges from vertex (x, y) to (x + ex, y + ey)
+	LineSetup8 setup;
+	auto Edges = [&]( const int y, const int ex, const int ey, const int count )
+	{
+		const int* ax = gx.data() + y * columns, * ay = gy.data() + y * columns;
+		const int* bx = ax + ex + ey * columns, * by = ay + ex + ey * columns;
+		int x = 0;
+		if (CPUCaps::HW_AVX2) for (; x + 8 <= count; x += 8)
+		{
+			const __m256i x1 = _mm256_loadu_si256( (const __m256i*)(ax + x) ), x2 = _mm256_loadu_si256( (const __m256i*)(bx + x) );
+			// the sign bit marks off-surface vertices
+			const int accept = ~_mm256_movemask_ps( _mm256_castsi256_ps( _mm256_or_si256( x1, x2 ) ) ) & 255;
+			if (accept) Setup8( x1, _mm256_loadu_si256( (const __m256i*)(ay + x) ), x2, _mm256_loadu_si256( (const __m256i*)(by + x) ), pitch, setup );
+			for (int j = 0; j < 8; j++)
+			{
+				if (accept & (1 << j)) Bresenham( pixels + setup.offset[j], setup.n[j], setup.d[j], setup.major[j], setup.minor[j], c );
+				else
+				{
+					const float2& a = P( x + j, y ), & b = P( x + j + ex, y + ey );
+					Line( a.x, a.y, b.x, b.y, c );
+				}
+			}
+		}
+		for (; x < count; x++)
+		{
+			if ((ax[x] | bx[x]) >= 0) LineNoClip( ax[x], ay[x], bx[x], by[x], c ); else
+			{
+				const float2& a = P( x, y ), & b = P( x + ex, y + ey );
+				Line( a.x, a.y, b.x, b.y, c );
+			}
+		}
+	};
+	for (int y = 0; y < rows; y++)
 	{
-		*(pixels + (int)x1 + (int)y1 * width) = c;
-		x1 += dx, y1 += dy;
+		Edges( y, 1, 0, columns - 1 );
+		if (y < rows - 1) Edges( y, 0, 1, columns );
 	}
 }
 
-void Surface::CopyTo( Surface* d, int x, int y )
+// span pixel operations
+// ----------------------------------------------------------------------------
+
+// per channel (c * scale) >> 8, alpha included, like the scalar ScaleColor.
+// Channels overflow into their neighbours beyond 256 there; such scales are
+// left to the scalar version.
+void Tmpl8::ScaleColor( uint* dst, const uint* src, const int n, const uint scale )
+{
+	int i = 0;
+	if (CPUCaps::HW_AVX2 && scale <= 256)
+	{
+		const __m256i zero = _mm256_setzero_si256(), s16 = _mm256_set1_epi16( (short)scale );
+		for (; i + 8 <= n; i += 8)
+		{
+			const __m256i p = _mm256_loadu_si256( (const __m256i*)(src + i) );
+			// widen to 16 bits per channel; unpack and pack work per 128-bit lane, so the order is kept
+			const __m256i lo = _mm256_srli_epi16( _mm256_mullo_epi16( _mm256_unpacklo_epi8( p, zero ), s16 ), 8 );
+			const __m256i hi = _mm256_srli_epi16( _mm256_mullo_epi16( _mm256_unpackhi_epi8( p, zero ), s16 ), 8 );
+			_mm256_storeu_si256( (__m256i*)(dst + i), _mm256_packus_epi16( lo, hi ) );
+		}
+	}
+	for (; i < n; i++) dst[i] = ScaleColor( src[i], scale );
+}
+
+// saturating add / subtract per color channel; alpha becomes zero, like the
+// scalar versions
+void Tmpl8::AddBlend( uint* dst, const uint* src, const int n )
+{
+	int i = 0;
+	if (CPUCaps::HW_AVX2)
+	{
+		const __m256i rgb = _mm256_set1_epi32( 0xffffff );
+		for (; i + 8 <= n; i += 8)
+		{
+			const __m256i d = _mm256_loadu_si256( (const __m256i*)(dst + i) ), s = _mm256_loadu_si256( (const __m256i*)(src + i) );
+			_mm256_storeu_si256( (__m256i*)(dst + i), _mm256_and_si256( _mm256_adds_epu8( d, s ), rgb ) );
+		}
+	}
+	for (; i < n; i++) dst[i] = AddBlend( dst[i], src[i] );
+}
+
+void Tmpl8::SubBlend( uint* dst, const uint* src, const int n )
+{
+	int i = 0;
+	if (CPUCaps::HW_AVX2)
+	{
+		const __m256i rgb = _mm256_set1_epi32( 0xffffff );
+		for (; i + 8 <= n; i += 8)
+		{
+			const __m256i d = _mm256_loadu_si256( (const __m256i*)(dst + i) ), s = _mm256_loadu_si256( (const __m256i*)(src + i) );
+			_mm256_storeu_si256( (__m256i*)(dst + i), _mm256_and_si256( _mm256_subs_epu8( d, s ), rgb ) );
+		}
+	}
+	for (; i < n; i++) dst[i] = SubBlend( dst[i], src[i] );
+}
+
+// copy to another surface, optionally adding to or subtracting from its pixels
+void Surface::CopyTo( Surface* d, int x, int y, int mode )
 {
 	uint* dst = d->pixels;
 	uint* src = pixels;
@@ -152,82 +808,26 @@ void Surface::CopyTo( Surface* d, int x, int y )
 		if ((srcwidth + x) > dstwidth) srcwidth = dstwidth - x;
 		if ((srcheight + y) > dstheight) srcheight = dstheight - y;
 		if (x < 0) src -= x, srcwidth += x, x = 0;
-		if (y < 0) src -= y * srcwidth, srcheight += y, y = 0;
+		if (y < 0) src -= y * pitch, srcheight += y, y = 0;
 		if ((srcwidth > 0) && (srcheight > 0))
 		{
-			dst += x + dstwidth * y;
+			d->MarkDirty( x, y, x + srcwidth - 1, y + srcheight - 1 );
+			dst += x + d->pitch * y;
 			for (int i = 0; i < srcheight; i++)
 			{
-				memcpy( dst, src, srcwidth * 4 );
-				dst += dstwidth, src += width;
+				if (mode == ADDITIVE) AddBlend( dst, src, srcwidth );
+				else if (mode == SUBTRACTIVE) SubBlend( dst, src, srcwidth );
+				else memcpy( dst, src, srcwidth * 4 );
+				dst += d->pitch, src += pitch;
 			}
 		}
 	}
 }
 
-void Surface::SetChar( int c, const char* c1, const char* c2, const char* c3, const char* c4, const char* c5 )
-{
-	strcpy( s_Font[c][0], c1 );
-	strcpy( s_Font[c][1], c2 );
-	strcpy( s_Font[c][2], c3 );
-	strcpy( s_Font[c][3], c4 );
-	strcpy( s_Font[c][4], c5 );
-}
-
-void Surface::InitCharset()
-{
-	SetChar( 0, ":ooo:", "o:::o", "ooooo", "o:::o", "o:::o" );
-	SetChar( 1, "oooo:", "o:::o", "oooo:", "o:::o", "oooo:" );
-	SetChar( 2, ":oooo", "o::::", "o::::", "o::::", ":oooo" );
-	SetChar( 3, "oooo:", "o:::o", "o:::o", "o:::o", "oooo:" );
-	SetChar( 4, "ooooo", "o::::", "oooo:", "o::::", "ooooo" );
-	SetChar( 5, "ooooo", "o::::", "ooo::", "o::::", "o::::" );
-	SetChar( 6, ":oooo", "o::::", "o:ooo", "o:::o", ":ooo:" );
-	SetChar( 7, "o:::o", "o:::o", "ooooo", "o:::o", "o:::o" );
-	SetChar( 8, "::o::", "::o::", "::o::", "::o::", "::o::" );
-	SetChar( 9, ":::o:", ":::o:", ":::o:", ":::o:", "ooo::" );
-	SetChar( 10, "o::o:", "o:o::", "oo:::", "o:o::", "o::o:" );
-	SetChar( 11, "o::::", "o::::", "o::::", "o::::", "ooooo" );
-	SetChar( 12, "oo:o:", "o:o:o", "o:o:o", "o:::o", "o:::o" );
-	SetChar( 13, "o:::o", "oo::o", "o:o:o", "o::oo", "o:::o" );
-	SetChar( 14, ":ooo:", "o:::o", "o:::o", "o:::o", ":ooo:" );
-	SetChar( 15, "oooo:", "o:::o", "oooo:", "o::::", "o::::" );
-	SetChar( 16, ":ooo:", "o:::o", "o:::o", "o::oo", ":oooo" );
-	SetChar( 17, "oooo:", "o:::o", "oooo:", "o:o::", "o::o:" );
-	SetChar( 18, ":oooo", "o::::", ":ooo:", "::::o", "oooo:" );
-	SetChar( 19, "ooooo", "::o::", "::o::", "::o::", "::o::" );
-	SetChar( 20, "o:::o", "o:::o", "o:::o", "o:::o", ":oooo" );
-	SetChar( 21, "o:::o", "o:::o", ":o:o:", ":o:o:", "::o::" );
-	SetChar( 22, "o:::o", "o:::o", "o:o:o", "o:o:o", ":o:o:" );
-	SetChar( 23, "o:::o", ":o:o:", "::o::", ":o:o:", "o:::o" );
-	SetChar( 24, "o:::o", "o:::o", ":oooo", "::::o", ":ooo:" );
-	SetChar( 25, "ooooo", ":::o:", "::o::", ":o:::", "ooooo" );
-	SetChar( 26, ":ooo:", "o::oo", "o:o:o", "oo::o", ":ooo:" );
-	SetChar( 27, "::o::", ":oo::", "::o::", "::o::", ":ooo:" );
-	SetChar( 28, ":ooo:", "o:::o", "::oo:", ":o:::", "ooooo" );
-	SetChar( 29, "oooo:", "::::o", "::oo:", "::::o", "oooo:" );
-	SetChar( 30, "o::::", "o::o:", "ooooo", ":::o:", ":::o:" );
-	SetChar( 31, "ooooo", "o::::", "oooo:", "::::o", "oooo:" );
-	SetChar( 32, ":oooo", "o::::", "oooo:", "o:::o", ":ooo:" );
-	SetChar( 33, "ooooo", "::::o", ":::o:", "::o::", "::o::" );
-	SetChar( 34, ":ooo:", "o:::o", ":ooo:", "o:::o", ":ooo:" );
-	SetChar( 35, ":ooo:", "o:::o", ":oooo", "::::o", ":ooo:" );
-	SetChar( 36, "::o::", "::o::", "::o::", ":::::", "::o::" );
-	SetChar( 37, ":ooo:", "::::o", ":::o:", ":::::", "::o::" );
-	SetChar( 38, ":::::", ":::::", "::o::", ":::::", "::o::" );
-	SetChar( 39, ":::::", ":::::", ":ooo:", ":::::", ":ooo:" );
-	SetChar( 40, ":::::", ":::::", ":::::", ":::o:", "::o::" );
-	SetChar( 41, ":::::", ":::::", ":::::", ":::::", "::o::" );
-	SetChar( 42, ":::::", ":::::", ":ooo:", ":::::", ":::::" );
-	SetChar( 43, ":::o:", "::o::", "::o::", "::o::", ":::o:" );
-	SetChar( 44, "::o::", ":::o:", ":::o:", ":::o:", "::o::" );
-	SetChar( 45, ":::::", ":::::", ":::::", ":::::", ":::::" );
-	SetChar( 46, "ooooo", "ooooo", "ooooo", "ooooo", "ooooo" );
-	SetChar( 47, "::o::", "::o::", ":::::", ":::::", ":::::" ); // Tnx Ferry
-	SetChar( 48, "o:o:o", ":ooo:", "ooooo", ":ooo:", "o:o:o" );
-	SetChar( 49, "::::o", ":::o:", "::o::", ":o:::", "o::::" );
-	char c[] = "abcdefghijklmnopqrstuvwxyz0123456789!?:=,.-() #'*/";
-	int i;
-	for (i = 0; i < 256; i++) s_Transl[i] = 45;
-	for (i = 0; i < 50; i++) s_Transl[(unsigned char)c[i]] = i;
+// scale all pixels by scale / 256
+void Surface::Fade( uint scale )
+{
+	if (parent) ForRows( 0, height, width, [&]( const int y ) { ScaleColor( pixels + y * pitch, pixels + y * pitch, width, scale ); } );
+	else ForBlocks( pitch * height, [&]( const int first, const int n ) { ScaleColor( pixels + first, pixels + first, n, scale ); } );
+	MarkDirty( 0, 0, width - 1, height - 1 );
 }
@@ -34,32 +34,79 @@ inline uint SubBlend( uint a_Color1, uint a_Color2 )
 	return (uint)(red + green + blue);
 }
 
-// 32-bit surface container
+// span versions of the pixel operations: n pixels, 8 at a time with AVX2.
+// dst and src may be the same.
+void ScaleColor( uint* dst, const uint* src, const int n, const uint scale );
+void AddBlend( uint* dst, const uint* src, const int n );
+void SubBlend( uint* dst, const uint* src, const int n );
+
+// 32-bit surface container. Rows are pitch pixels apart; surfaces that
+// allocate their own buffer pad rows to a multiple of 64 bytes, so every row
+// starts cache line aligned. A view shares the pixels of a sub-rectangle of
+// another surface: drawing to it is clipped to that rectangle, and dirty
+// regions are forwarded to the surface that owns the pixels.
 class Surface
 {
 	enum { OWNER = 1 };
 public:
+	enum { COPY = 0, ADDITIVE, SUBTRACTIVE }; // CopyTo blend modes
 	// constructor / destructor
 	Surface() = default;
 	Surface( int w, int h, uint* buffer );
 	Surface( int w, int h );
+	Surface( Surface* parent, int x, int y, int w, int h );
 	Surface( const char* file );
 	~Surface();
 	// operations
-	void InitCharset();
-	void SetChar( int c, const char* c1, const char* c2, const char* c3, const char* c4, const char* c5 );
 	void Print( const char* t, int x1, int y1, uint c );
 	void Clear( uint c );
+	void ClearStreaming( uint c );
+	void ClearDirty( uint c );
 	void Line( float x1, float y1, float x2, float y2, uint c );
+	bool ClipLine( float& x1, float& y1, float& x2, float& y2 ) const;
+	void LineNoClip( int x1, int y1, int x2, int y2, uint c );
+	void LineInRect( int x1, int y1, int x2, int y2, uint c, int rx1, int ry1, int rx2, int ry2 );
+	void Lines( const float2* a, const float2* b, const int count, uint c );
+	void Grid( const float2* pos, const int stride, const int rowStride, const int columns, const int rows, uint c );
 	void Plot( int x, int y, uint c );
 	void LoadFromFile( const char* file );
-	void CopyTo( Surface* dst, int x, int y );
+	bool Decode( const char* file, const time_t mtime ); // false if it is no image; used by LoadFromFile
+	// decodes on the job manager and returns when all results are set
+	static void LoadBatch( const char** files, Surface** result, const int count );
+	// decoded images are cached, up to a limit; the least recently used go first
+	static void FlushImageCache();
+	static void SetImageCacheLimit( const size_t bytes );
+	void CopyTo( Surface* dst, int x, int y, int mode = COPY );
+	void Fade( uint scale );
+	void AddLine( float x1, float y1, float x2, float y2, uint c );
 	void Box( int x1, int y1, int x2, int y2, uint color );
 	void Bar( int x1, int y1, int x2, int y2, uint color );
+	// dirty region tracking (opt-in). Drawing operations extend 'dirty';
+	// ClearDirty then only clears what was drawn since the previous clear,
+	// and TakeChanged returns what differs from the last presented frame.
+	// Use ClearDirty only if all code that writes to pixels directly calls
+	// MarkDirty itself; Clear always clears everything. Views forward to
+	// their parent, and follow the tracking state it had when the view was
+	// created.
+	void TrackDirty( bool enable );
+	void MarkDirty( int x1, int y1, int x2, int y2 )
+	{
+		if (!trackDirty || x2 < 0 || y2 < 0 || x1 >= width || y1 >= height || x1 > x2 || y1 > y2) return;
+		if (parent) { parent->MarkDirty( max( x1, 0 ) + ox, max( y1, 0 ) + oy, min( x2, width - 1 ) + ox, min( y2, height - 1 ) + oy ); return; }
+		dirty.x = min( dirty.x, max( x1, 0 ) ), dirty.y = min( dirty.y, max( y1, 0 ) );
+		dirty.z = max( dirty.z, min( x2, width - 1 ) ), dirty.w = max( dirty.w, min( y2, height - 1 ) );
+	}
+	void MarkDirty( const float2* p, const int count, const int stride );
+	int4 TakeChanged();
 	// attributes
 	uint* pixels = 0;
-	int width = 0, height = 0;
+	int width = 0, height = 0, pitch = 0; // pitch: row stride in pixels
+	Surface* parent = 0; // for views: the surface that owns the pixels
+	int ox = 0, oy = 0; // for views: position in the parent
 	bool ownBuffer = false;
+	bool trackDirty = false;
+	int4 dirty, changed; // x1, y1, x2, y2, inclusive; empty if x1 > x2
+	uint clearColor = 0;
 };
 
 }
\ No newline at end of file
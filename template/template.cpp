@@ -5,7 +5,11 @@
 #include "precomp.h"
 #include "game.h"
 
+#ifdef HEADLESS
+#pragma comment( linker, "/subsystem:console /ENTRY:mainCRTStartup" )
+#else
 #pragma comment( linker, "/subsystem:windows /ENTRY:mainCRTStartup" )
+#endif
 
 using namespace Tmpl8;
 
@@ -25,10 +29,7 @@ extern "C"
 }
 #endif
 
-GLFWwindow* window = 0;
 static bool hasFocus = true, running = true;
-static GLTexture* renderTarget = 0;
-static int scrwidth = 0, scrheight = 0;
 static TheApp* app = 0;
 bool IGP_detected = false;
 
@@ -37,15 +38,47 @@ uint keystate[256] = { 0 };
 // static member data for instruction set support class
 static const CPUCaps cpucaps;
 
-// provide access to the render target, for OpenCL / OpenGL interop
-GLTexture* GetRenderTarget() { return renderTarget; }
-
 // provide access to window focus state
 bool WindowHasFocus() { return hasFocus; }
 
 // provide access to key state array
 bool IsKeyDown( const uint key ) { return keystate[key & 255] == 1; }
 
+#ifdef HEADLESS
+
+// Application entry point, without a window
+// Renders for machines without a GPU: frames go to a FrameSink instead of
+// the screen, and none are dropped.
+void main()
+{
+	Surface* screen = new Surface( SCRWIDTH, SCRHEIGHT );
+	app = new Game();
+	app->screen = screen;
+	app->Init();
+	FrameSink sink( HEADLESS, SCRWIDTH, SCRHEIGHT );
+	sink.blocking = true;
+	Timer timer;
+	for (int frameNr = 0; frameNr < HEADLESS_FRAMES; frameNr++)
+	{
+		const float deltaTime = min( 500.0f, 1000.0f * timer.elapsed() );
+		timer.reset();
+		if (frameNr > 2) GetFrameStats().Record( FrameStats::FRAME, deltaTime );
+		app->Tick( deltaTime );
+		sink.Submit( screen );
+	}
+	app->Shutdown();
+	GetFrameStats().Dump( "framestats.json" );
+}
+
+#else
+
+GLFWwindow* window = 0;
+static GLTexture* renderTarget = 0;
+static int scrwidth = 0, scrheight = 0;
+
+// provide access to the render target, for OpenCL / OpenGL interop
+GLTexture* GetRenderTarget() { return renderTarget; }
+
 // GLFW callbacks
 void InitRenderTarget( int w, int h )
 {
@@ -336,6 +369,7 @@ void main()
 	{
 		deltaTime = min( 500.0f, 1000.0f * timer.elapsed() );
 		timer.reset();
+		if (frameNr > 2) GetFrameStats().Record( FrameStats::FRAME, deltaTime );
 		app->Tick( deltaTime );
 		// send the rendering result to the screen using OpenGL
 		if (frameNr++ > 1)
@@ -352,152 +386,13 @@ void main()
 	}
 	// close down
 	app->Shutdown();
+	GetFrameStats().Dump( "framestats.json" );
 	Kernel::KillCL();
 	glfwDestroyWindow( window );
 	glfwTerminate();
 }
 
-// Jobmanager implementation
-DWORD JobThreadProc( LPVOID lpParameter )
-{
-	JobThread* JobThreadInstance = (JobThread*)lpParameter;
-	JobThreadInstance->BackgroundTask();
-	return 0;
-}
-
-void JobThread::CreateAndStartThread( unsigned int threadId )
-{
-	m_GoSignal = CreateEvent( 0, FALSE, FALSE, 0 );
-	m_ThreadHandle = CreateThread( 0, 0, (LPTHREAD_START_ROUTINE)&JobThreadProc, (LPVOID)this, 0, 0 );
-	m_ThreadID = threadId;
-}
-void JobThread::BackgroundTask()
-{
-	while (1)
-	{
-		WaitForSingleObject( m_GoSignal, INFINITE );
-		while (1)
-		{
-			Job* job = JobManager::GetJobManager()->GetNextJob();
-			if (!job)
-			{
-				JobManager::GetJobManager()->ThreadDone( m_ThreadID );
-				break;
-			}
-			job->RunCodeWrapper();
-		}
-	}
-}
-
-void JobThread::Go()
-{
-	SetEvent( m_GoSignal );
-}
-
-void Job::RunCodeWrapper()
-{
-	Main();
-}
-
-JobManager* JobManager::m_JobManager = 0;
-
-JobManager::JobManager( unsigned int threads ) : m_NumThreads( threads )
-{
-	InitializeCriticalSection( &m_CS );
-}
-
-JobManager::~JobManager()
-{
-	DeleteCriticalSection( &m_CS );
-}
-
-void JobManager::CreateJobManager( unsigned int numThreads )
-{
-	m_JobManager = new JobManager( numThreads );
-	m_JobManager->m_JobThreadList = new JobThread[numThreads];
-	for (unsigned int i = 0; i < numThreads; i++)
-	{
-		m_JobManager->m_JobThreadList[i].CreateAndStartThread( i );
-		m_JobManager->m_ThreadDone[i] = CreateEvent( 0, FALSE, FALSE, 0 );
-	}
-	m_JobManager->m_JobCount = 0;
-}
-
-void JobManager::AddJob2( Job* a_Job )
-{
-	m_JobList[m_JobCount++] = a_Job;
-}
-
-Job* JobManager::GetNextJob()
-{
-	Job* job = 0;
-	EnterCriticalSection( &m_CS );
-	if (m_JobCount > 0) job = m_JobList[--m_JobCount];
-	LeaveCriticalSection( &m_CS );
-	return job;
-}
-
-void JobManager::RunJobs()
-{
-	if (m_JobCount == 0) return;
-	for (unsigned int i = 0; i < m_NumThreads; i++) m_JobThreadList[i].Go();
-	WaitForMultipleObjects( m_NumThreads, m_ThreadDone, TRUE, INFINITE );
-}
-
-void JobManager::ThreadDone( unsigned int n )
-{
-	SetEvent( m_ThreadDone[n] );
-}
-
-DWORD CountSetBits( ULONG_PTR bitMask )
-{
-	DWORD LSHIFT = sizeof( ULONG_PTR ) * 8 - 1, bitSetCount = 0;
-	ULONG_PTR bitTest = (ULONG_PTR)1 << LSHIFT;
-	for (DWORD i = 0; i <= LSHIFT; ++i) bitSetCount += ((bitMask & bitTest) ? 1 : 0), bitTest /= 2;
-	return bitSetCount;
-}
-
-void JobManager::GetProcessorCount( uint& cores, uint& logical )
-{
-	// https://github.com/GPUOpen-LibrariesAndSDKs/cpu-core-counts
-	cores = logical = 0;
-	char* buffer = NULL;
-	DWORD len = 0;
-	if (FALSE == GetLogicalProcessorInformationEx( RelationAll, (PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX)buffer, &len ))
-	{
-		if (GetLastError() == ERROR_INSUFFICIENT_BUFFER)
-		{
-			buffer = (char*)malloc( len );
-			if (GetLogicalProcessorInformationEx( RelationAll, (PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX)buffer, &len ))
-			{
-				char* ptr = buffer;
-				while (ptr < buffer + len)
-				{
-					PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX pi = (PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX)ptr;
-					if (pi->Relationship == RelationProcessorCore)
-					{
-						cores++;
-						for (size_t g = 0; g < pi->Processor.GroupCount; ++g)
-							logical += CountSetBits( pi->Processor.GroupMask[g].Mask );
-					}
-					ptr += pi->Size;
-				}
-			}
-			free( buffer );
-		}
-	}
-}
-
-JobManager* JobManager::GetJobManager()
-{
-	if (!m_JobManager)
-	{
-		uint c, l;
-		GetProcessorCount( c, l );
-		CreateJobManager( l );
-	}
-	return m_JobManager;
-}
+#endif
 
 // Helper functions
 bool FileIsNewer( const char* file1, const char* file2 )
@@ -561,6 +456,9 @@ void TextFileWrite( const string& text, const char* _File )
 	s.write( text.c_str(), len );
 }
 
+// no OpenGL loader in headless builds
+#ifndef HEADLESS
+
 /*
 
 	OpenGL loader generated by glad 0.1.35 on Fri Mar 18 11:02:23 2022.
@@ -1703,4 +1601,6 @@ int gladLoadGLLoader( GLADloadproc load ) {
 	return GLVersion.major != 0 || GLVersion.minor != 0;
 }
 
+#endif
+
 // EOF
\ No newline at end of file
@@ -0,0 +1,203 @@
+// Template, IGAD version 3
+// Get the latest version from: https://github.com/jbikker/tmpl8
+// IGAD/NHTV/UU - Jacco Bikker - 2006-2023
+
+#include "precomp.h"
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+// Topology implementation
+// ----------------------------------------------------------------------------
+
+const Topology& Topology::Get()
+{
+	static Topology topology;
+	static once_flag discovered;
+	call_once( discovered, []() { topology.Discover(); } );
+	return topology;
+}
+
+// index of key in seen; appended if it is new
+static int Dense( vector<int64_t>& seen, const int64_t key )
+{
+	for (size_t i = 0; i < seen.size(); i++) if (seen[i] == key) return (int)i;
+	seen.push_back( key );
+	return (int)seen.size() - 1;
+}
+
+#ifdef __linux__
+
+// first integer in a sysfs file, or -1
+static int ReadInt( const char* path )
+{
+	FILE* f = fopen( path, "r" );
+	if (!f) return -1;
+	int v = -1;
+	if (fscanf( f, "%i", &v ) != 1) v = -1;
+	fclose( f );
+	return v;
+}
+
+// a sysfs cpu list, such as "0-3,8-11"
+static vector<int> ReadList( const char* path )
+{
+	vector<int> list;
+	FILE* f = fopen( path, "r" );
+	if (!f) return list;
+	int a, b;
+	while (fscanf( f, "%i", &a ) == 1)
+	{
+		b = a;
+		int c = fgetc( f );
+		if (c == '-') { if (fscanf( f, "%i", &b ) != 1) break; c = fgetc( f ); }
+		for (int i = a; i <= b; i++) list.push_back( i );
+		if (c != ',') break;
+	}
+	fclose( f );
+	return list;
+}
+
+#endif
+
+void Topology::Discover()
+{
+	vector<int64_t> coreKeys, l3Keys, nodeKeys;
+#ifdef __linux__
+	// only the processors this process may use; a container or taskset may restrict these
+	cpu_set_t allowed;
+	if (sched_getaffinity( 0, sizeof( allowed ), &allowed ) != 0) CPU_ZERO( &allowed );
+	vector<int> nodeOf( CPU_SETSIZE, 0 );
+	for (int node : ReadList( "/sys/devices/system/node/online" ))
+	{
+		char path[128];
+		sprintf( path, "/sys/devices/system/node/node%i/cpulist", node );
+		for (int cpu : ReadList( path )) if (cpu < CPU_SETSIZE) nodeOf[cpu] = node;
+	}
+	for (int id = 0; id < CPU_SETSIZE; id++) if (CPU_ISSET( id, &allowed ))
+	{
+		char path[128];
+		sprintf( path, "/sys/devices/system/cpu/cpu%i/topology/physical_package_id", id );
+		const int package = ReadInt( path );
+		sprintf( path, "/sys/devices/system/cpu/cpu%i/topology/core_id", id );
+		const int core = ReadInt( path );
+		// the L3 domain is named after the first processor that shares it
+		int l3 = -1;
+		for (int i = 0; l3 < 0; i++)
+		{
+			sprintf( path, "/sys/devices/system/cpu/cpu%i/cache/index%i/level", id, i );
+			const int level = ReadInt( path );
+			if (level < 0) break;
+			if (level != 3) continue;
+			sprintf( path, "/sys/devices/system/cpu/cpu%i/cache/index%i/shared_cpu_list", id, i );
+			vector<int> shared = ReadList( path );
+			l3 = shared.empty() ? id : shared[0];
+		}
+		LogicalCPU cpu;
+		cpu.id = id;
+		cpu.core = core < 0 ? Dense( coreKeys, id ) : Dense( coreKeys, ((int64_t)package << 32) + core );
+		cpu.l3 = Dense( l3Keys, l3 < 0 ? package : l3 );
+		cpu.node = Dense( nodeKeys, nodeOf[id] );
+		cpus.push_back( cpu );
+	}
+#elif defined _WIN32
+	// https://github.com/GPUOpen-LibrariesAndSDKs/cpu-core-counts
+	DWORD len = 0;
+	GetLogicalProcessorInformationEx( RelationAll, 0, &len );
+	vector<char> buffer( len );
+	struct Domain { WORD group; KAFFINITY mask; };
+	vector<Domain> l3Masks, nodeMasks;
+	if (len > 0 && GetLogicalProcessorInformationEx( RelationAll, (PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX)buffer.data(), &len ))
+		for (char* ptr = buffer.data(); ptr < buffer.data() + len;)
+		{
+			PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX pi = (PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX)ptr;
+			if (pi->Relationship == RelationProcessorCore)
+			{
+				const int core = (int)coreKeys.size();
+				coreKeys.push_back( core );
+				for (WORD g = 0; g < pi->Processor.GroupCount; g++) for (int bit = 0; bit < 64; bit++)
+					if (pi->Processor.GroupMask[g].Mask & ((KAFFINITY)1 << bit))
+					{
+						LogicalCPU cpu = {};
+						cpu.id = 64 * pi->Processor.GroupMask[g].Group + bit, cpu.core = core;
+						cpus.push_back( cpu );
+					}
+			}
+			else if (pi->Relationship == RelationCache && pi->Cache.Level == 3) l3Masks.push_back( { pi->Cache.GroupMask.Group, pi->Cache.GroupMask.Mask } );
+			else if (pi->Relationship == RelationNumaNode) nodeMasks.push_back( { pi->NumaNode.GroupMask.Group, pi->NumaNode.GroupMask.Mask } );
+			ptr += pi->Size;
+		}
+	auto Find = []( const vector<Domain>& list, const int id )
+	{
+		for (size_t i = 0; i < list.size(); i++)
+			if (list[i].group == id / 64 && (list[i].mask & ((KAFFINITY)1 << (id & 63)))) return (int)i;
+		return 0;
+	};
+	for (LogicalCPU& cpu : cpus) cpu.l3 = Dense( l3Keys, Find( l3Masks, cpu.id ) ), cpu.node = Dense( nodeKeys, Find( nodeMasks, cpu.id ) );
+#endif
+	if (cpus.empty())
+	{
+		// nothing known: independent processors, one L3 and one node
+		const int n = max( 1u, thread::hardware_concurrency() );
+		for (int i = 0; i < n; i++) cpus.push_back( { i, Dense( coreKeys, i ), 0, Dense( l3Keys, 0 ), Dense( nodeKeys, 0 ) } );
+	}
+	// SMT siblings are numbered in order of their processor ids
+	for (size_t i = 0; i < cpus.size(); i++)
+	{
+		cpus[i].smt = 0;
+		for (size_t j = 0; j < i; j++) cpus[i].smt += cpus[j].core == cpus[i].core;
+	}
+	cores = (int)coreKeys.size(), l3s = (int)l3Keys.size(), nodes = (int)nodeKeys.size();
+}
+
+vector<int> Topology::Order( const int policy ) const
+{
+	vector<int> order;
+	for (int i = 0; i < (int)cpus.size(); i++) if (policy != CORES || cpus[i].smt == 0) order.push_back( i );
+	// compact: siblings, then cores of an L3 domain, then domains of a node, together
+	auto Compact = [this]( const int a, const int b )
+	{
+		const LogicalCPU& p = cpus[a], & q = cpus[b];
+		if (p.node != q.node) return p.node < q.node;
+		if (p.l3 != q.l3) return p.l3 < q.l3;
+		if (p.core != q.core) return p.core < q.core;
+		return p.smt < q.smt;
+	};
+	stable_sort( order.begin(), order.end(), Compact );
+	if (policy != SCATTER) return order;
+	// scatter: the n-th core of every L3 domain of every node, before the n+1-th
+	vector<int> coreRank( cpus.size() ), l3Rank( cpus.size() );
+	vector<int> coresInL3( l3s ), l3sInNode( nodes ), l3RankOf( l3s, -1 );
+	for (int i : order)
+	{
+		const LogicalCPU& c = cpus[i];
+		if (l3RankOf[c.l3] < 0) l3RankOf[c.l3] = l3sInNode[c.node]++;
+		if (c.smt == 0) coresInL3[c.l3]++;
+		coreRank[i] = coresInL3[c.l3] - 1, l3Rank[i] = l3RankOf[c.l3];
+	}
+	stable_sort( order.begin(), order.end(), [&]( const int a, const int b )
+	{
+		if (cpus[a].smt != cpus[b].smt) return cpus[a].smt < cpus[b].smt;
+		if (coreRank[a] != coreRank[b]) return coreRank[a] < coreRank[b];
+		if (l3Rank[a] != l3Rank[b]) return l3Rank[a] < l3Rank[b];
+		return cpus[a].node < cpus[b].node;
+	} );
+	return order;
+}
+
+bool Topology::PinCurrentThread( const LogicalCPU& cpu )
+{
+#ifdef __linux__
+	cpu_set_t set;
+	CPU_ZERO( &set );
+	CPU_SET( cpu.id, &set );
+	return sched_setaffinity( 0, sizeof( set ), &set ) == 0; // 0: the calling thread
+#elif defined _WIN32
+	GROUP_AFFINITY affinity = {};
+	affinity.Group = (WORD)(cpu.id / 64), affinity.Mask = (KAFFINITY)1 << (cpu.id & 63);
+	return SetThreadGroupAffinity( GetCurrentThread(), &affinity, 0 ) != 0;
+#else
+	return false;
+#endif
+}
@@ -0,0 +1,36 @@
+// Template, IGAD version 3
+// Get the latest version from: https://github.com/jbikker/tmpl8
+// IGAD/NHTV/UU - Jacco Bikker - 2006-2023
+
+#pragma once
+
+// Processor topology: the logical processors this process may run on, with
+// their physical core, L3 domain and NUMA node. Read from sysfs on Linux and
+// from GetLogicalProcessorInformationEx on Windows. Core, L3 and node numbers
+// are dense: 0..cores-1 and so on, in the order they were found.
+struct LogicalCPU
+{
+	int id;			// OS number; on Windows, 64 * group + bit
+	int core, smt;	// physical core, and the index among its SMT siblings
+	int l3, node;
+};
+
+class Topology
+{
+public:
+	// pinning policies, for JobManager::CreateJobManager
+	enum
+	{
+		NONE = 0,	// no pinning: all logical processors, the OS decides
+		CORES,		// one thread per physical core, SMT siblings stay idle
+		COMPACT,	// fill a core, then an L3 domain, then a node
+		SCATTER		// spread over nodes and L3 domains first; siblings last
+	};
+	static const Topology& Get(); // discovered on first use
+	vector<int> Order( const int policy ) const; // logical processors (indices in cpus) for threads 0, 1, ...
+	static bool PinCurrentThread( const LogicalCPU& cpu );
+	vector<LogicalCPU> cpus;
+	int cores = 0, l3s = 0, nodes = 0;
+private:
+	void Discover();
+};